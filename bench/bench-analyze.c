@@ -0,0 +1,276 @@
+/* bench-analyze.c */
+
+/* Cost of the analysis of a window against the density of candidate
+   tiles. Every window gets a synthetic profile of a square of tiles on
+   a number of zoom levels. A share of the tiles, the density, has a
+   size matching the responses of the window, the others never match.
+   On top of the random candidates a number of viewports is planted as
+   solid retangles. The matching, the retangle search and the clustering
+   are timed separately, so changes to the analysis can be judged on
+   the dense windows where it hurts and not only on sparse ones. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gmaps.h"
+#include "gmaps-analyze.h"
+
+#define BASE_ZOOM		2
+#define VIEW_W			4
+#define VIEW_H			3
+
+/* the sizes of the candidates lie within the range a response of
+   MIN_TILE_LEN + TILE_LEN_RANGE matches, the other tiles are bigger */
+#define HIT_LEN			(MIN_TILE_LEN + TILE_LEN_RANGE)
+#define MISS_MIN_LEN		(MIN_TILE_LEN + 3 * TILE_LEN_RANGE)
+
+static const double densities[] = {
+	0.01, 0.02, 0.05, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.8, 1.0
+};
+static const uint32_t zoom_spreads[] = { 1, 2, 4 };
+
+enum phase {
+	PHASE_MATCHES,
+	PHASE_RETANGLES,
+	PHASE_CLUSTER,
+	PHASE_TOTAL,
+	PHASES
+};
+
+static uint32_t grid = 64;
+static uint32_t nr_entries = 12;
+static uint32_t nr_planted = 1;
+static uint32_t nr_windows = 5;
+
+/* the analysis reports through this, it stays quiet here */
+void
+verbose(int level, const char * fmt, ...)
+{
+}
+
+static uint32_t
+rnd(uint32_t n)
+{
+	return (uint32_t)random() % n;
+}
+
+static struct profile *
+make_profile(double density, uint32_t zooms)
+{
+	struct profile_entry pe;
+	struct profile * profile;
+	uint8_t * hit;
+	uint32_t z, x, y, i, x0, y0, sz;
+
+	profile = profile_new();
+	if (!profile) fatal("Out of memory.");
+
+	hit = xmalloc(grid * grid);
+	for (z=BASE_ZOOM;z<BASE_ZOOM+zooms;z++) {
+		for (i=0;i<grid*grid;i++)
+			hit[i] = (random() < density * RAND_MAX);
+		for (i=0;i<nr_planted;i++) {
+			if (i % zooms != z - BASE_ZOOM) continue;
+			x0 = rnd(grid - VIEW_W + 1);
+			y0 = rnd(grid - VIEW_H + 1);
+			for (x=x0;x<x0+VIEW_W;x++) {
+				for (y=y0;y<y0+VIEW_H;y++) hit[y*grid + x] = 1;
+			}
+		}
+
+		/* the square is in the middle of the world */
+		for (x=0;x<grid;x++) {
+			for (y=0;y<grid;y++) {
+				if (hit[y*grid + x]) {
+					sz = MIN_TILE_LEN +
+						rnd(2 * TILE_LEN_RANGE + 1);
+				}
+				else {
+					sz = MISS_MIN_LEN +
+						rnd(MAX_TILE_LEN - MISS_MIN_LEN);
+				}
+				pe.x = tiles_on_level(z) / 2 + x;
+				pe.y = tiles_on_level(z) / 2 + y;
+				pe.z = z;
+				pe.id = 0;
+				if (profile_add(profile, sz, &pe) < 0)
+					fatal("Out of memory.");
+			}
+		}
+	}
+	free(hit);
+
+	return profile;
+}
+
+/* Analyzes one window like analyze() does for a single region and
+   fills in the time of every phase. */
+static void
+analyze_window(struct profile * profile, uint32_t zmask, uint64_t * ns,
+	uint64_t * candidates, uint32_t * retangles)
+{
+	struct http_entry hte;
+	struct matches * matches;
+	struct list * list;
+	uint64_t t0, t1, t2, t3;
+	double lat, lng;
+	uint32_t i, z;
+
+	memset(&hte, 0, sizeof(struct http_entry));
+	for (z=0;z<MAX_Z;z++) *candidates -= zstats[z].candidates;
+
+	t0 = monotonic_ns();
+	matches = matches_new();
+	for (i=0;i<nr_entries;i++) {
+		hte.reslen = HIT_LEN;
+		hte.reqlen = 700;
+		matches_add(profile, 1, &matches, &hte, zmask);
+	}
+	t1 = monotonic_ns();
+	list = find_retangles(matches, zmask);
+	t2 = monotonic_ns();
+	*retangles += list_count(list);
+	if (list_count(list)) cluster_retangles(list, &lat, &lng);
+	t3 = monotonic_ns();
+
+	list_free(list);
+	matches_free(matches);
+
+	for (z=0;z<MAX_Z;z++) *candidates += zstats[z].candidates;
+	ns[PHASE_MATCHES] = t1 - t0;
+	ns[PHASE_RETANGLES] = t2 - t1;
+	ns[PHASE_CLUSTER] = t3 - t2;
+	ns[PHASE_TOTAL] = t3 - t0;
+}
+
+static int
+u64compare(const void * a, const void * b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x < y ? -1 : (x > y));
+}
+
+static void
+usage(const char * arg0)
+{
+	fprintf(stderr, "%s [options]\n", arg0);
+	fprintf(stderr, "Time the analysis phases against the density of");
+	fprintf(stderr, " candidate tiles.\n\n");
+	fprintf(stderr, "-g <tiles>     - side of the square of tiles per");
+	fprintf(stderr, " zoom level (default: %u)\n", grid);
+	fprintf(stderr, "-e <entries>   - req/res pairs per window");
+	fprintf(stderr, " (default: %u)\n", nr_entries);
+	fprintf(stderr, "-r <viewports> - solid viewports planted per window");
+	fprintf(stderr, " (default: %u)\n", nr_planted);
+	fprintf(stderr, "-w <windows>   - windows per point (default: %u)\n",
+		nr_windows);
+	fprintf(stderr, "-o <csv>       - also write the curves to this");
+	fprintf(stderr, " file\n");
+	fprintf(stderr, "-h             - usage information\n");
+}
+
+int
+main(int argc, char ** argv, char ** envp)
+{
+	uint64_t * ns[PHASES], t[PHASES], candidates;
+	uint32_t d, s, w, p, zooms, zmask, retangles;
+	struct profile * profile;
+	const char * csvfn = NULL;
+	double mid[PHASES];
+	FILE * csv = NULL;
+	int c;
+
+	while ((c = getopt(argc, argv, "hg:e:r:w:o:")) != -1) {
+		switch (c) {
+			case 'g':
+				grid = strtoul(optarg, NULL, 10);
+				break;
+			case 'e':
+				nr_entries = strtoul(optarg, NULL, 10);
+				break;
+			case 'r':
+				nr_planted = strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				nr_windows = strtoul(optarg, NULL, 10);
+				break;
+			case 'o':
+				csvfn = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (grid < VIEW_W || grid > 4096) fatal("Invalid square size.");
+	if (!nr_windows) fatal("Invalid number of windows.");
+
+	if (csvfn) {
+		csv = fopen(csvfn, "w");
+		if (!csv) fatal("Cannot write the curves.");
+		fprintf(csv, "zooms,density,candidates,retangles,matches_ms,"
+			"retangles_ms,cluster_ms,total_ms,max_total_ms\n");
+	}
+
+	for (p=0;p<PHASES;p++) ns[p] = xmalloc(sizeof(uint64_t) * nr_windows);
+
+	printf("%u x %u tiles per zoom level, %u pairs and %u planted "
+		"viewport%s per window, median of %u windows\n\n", grid, grid,
+		nr_entries, nr_planted, (nr_planted == 1 ? "" : "s"),
+		nr_windows);
+	printf("%5s %7s %10s %10s %11s %11s %11s %11s %11s\n", "zooms",
+		"density", "candidates", "retangles", "matches ms",
+		"retangles ms", "cluster ms", "total ms", "max ms");
+
+	for (s=0;s<sizeof(zoom_spreads)/sizeof(uint32_t);s++) {
+		zooms = zoom_spreads[s];
+		zmask = ((1 << zooms) - 1) << BASE_ZOOM;
+		for (d=0;d<sizeof(densities)/sizeof(double);d++) {
+			candidates = 0;
+			retangles = 0;
+			for (w=0;w<nr_windows;w++) {
+				srandom(w + 1);
+				profile = make_profile(densities[d], zooms);
+				analyze_window(profile, zmask, t, &candidates,
+					&retangles);
+				profile_unload(profile);
+				for (p=0;p<PHASES;p++) ns[p][w] = t[p];
+			}
+
+			for (p=0;p<PHASES;p++) {
+				qsort(ns[p], nr_windows, sizeof(uint64_t),
+					u64compare);
+				mid[p] = ns[p][nr_windows / 2] / 1e6;
+			}
+
+			printf("%5u %7.2f %10llu %10u %11.3f %12.3f %11.3f "
+				"%11.3f %11.3f\n", zooms, densities[d],
+				(unsigned long long)candidates / nr_windows,
+				retangles / nr_windows, mid[PHASE_MATCHES],
+				mid[PHASE_RETANGLES], mid[PHASE_CLUSTER],
+				mid[PHASE_TOTAL],
+				ns[PHASE_TOTAL][nr_windows - 1] / 1e6);
+			if (csv) {
+				fprintf(csv, "%u,%.2f,%llu,%u,%.3f,%.3f,%.3f,"
+					"%.3f,%.3f\n", zooms, densities[d],
+					(unsigned long long)candidates /
+					nr_windows, retangles / nr_windows,
+					mid[PHASE_MATCHES],
+					mid[PHASE_RETANGLES],
+					mid[PHASE_CLUSTER], mid[PHASE_TOTAL],
+					ns[PHASE_TOTAL][nr_windows - 1] / 1e6);
+			}
+			fflush(stdout);
+		}
+	}
+
+	if (csv) fclose(csv);
+	for (p=0;p<PHASES;p++) free(ns[p]);
+	return 0;
+}
+
+/* EOF */
@@ -0,0 +1,134 @@
+/* bench-coords.c */
+
+/* Accuracy and throughput of the batch tile/coordinate conversions
+   against the scalar tile_to_coord() and coord_to_tile(). */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gmaps.h"
+
+#define NR_COORDS	(1 << 20)
+#define ROUNDS		5
+#define MIN_ZOOM	0
+#define MAX_ZOOM	17
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char ** argv, char ** envp)
+{
+	struct coord * tiles, * c1, * c2, t1, t2;
+	double * lat, * lng, * blat, * blng;
+	double t, scalar_t, batch_t, err, max_lat_err, max_lng_err;
+	double sink = 0.0;
+	uint32_t i, r, z, world, mismatches;
+
+	tiles = xmalloc(sizeof(struct coord) * NR_COORDS);
+	c1 = xmalloc(sizeof(struct coord) * NR_COORDS);
+	c2 = xmalloc(sizeof(struct coord) * NR_COORDS);
+	lat = xmalloc(sizeof(double) * NR_COORDS);
+	lng = xmalloc(sizeof(double) * NR_COORDS);
+	blat = xmalloc(sizeof(double) * NR_COORDS);
+	blng = xmalloc(sizeof(double) * NR_COORDS);
+
+	srandom(42);
+
+	printf("%-5s %14s %14s %12s %12s %10s\n", "zoom", "scalar conv/s",
+		"batch conv/s", "lat err", "lng err", "tile diff");
+
+	for (z=MIN_ZOOM;z<=MAX_ZOOM;z++) {
+		world = tiles_on_level(z);
+		for (i=0;i<NR_COORDS;i++) {
+			tiles[i].x = random() % world;
+			tiles[i].y = random() % world;
+		}
+
+		/* tile -> coordinate */
+		t = now();
+		for (r=0;r<ROUNDS;r++) {
+			for (i=0;i<NR_COORDS;i++) {
+				tile_to_coord(z, &tiles[i], 0, 0,
+					&lat[i], &lng[i]);
+			}
+			sink += lat[r];
+		}
+		scalar_t = now() - t;
+
+		t = now();
+		for (r=0;r<ROUNDS;r++) {
+			tile_to_coord_batch(z, tiles, NR_COORDS, blat, blng);
+			sink += blat[r];
+		}
+		batch_t = now() - t;
+
+		max_lat_err = max_lng_err = 0.0;
+		for (i=0;i<NR_COORDS;i++) {
+			err = fabs(lat[i] - blat[i]);
+			if (err > max_lat_err) max_lat_err = err;
+			err = fabs(lng[i] - blng[i]);
+			if (err > max_lng_err) max_lng_err = err;
+		}
+
+		/* coordinate -> tile, fed with the coordinates from above
+		   moved away from the exact tile corners */
+		for (i=0;i<NR_COORDS;i++) {
+			lat[i] -= 1e-7;
+			lng[i] += 1e-7;
+		}
+		mismatches = 0;
+		coord_to_tile_batch(z, lat, lng, NR_COORDS, c1, c2);
+		for (i=0;i<NR_COORDS;i++) {
+			coord_to_tile(lat[i], lng[i], z, &t1, &t2);
+			if (memcmp(&t1, &c1[i], sizeof(t1)) ||
+					memcmp(&t2, &c2[i], sizeof(t2)))
+				mismatches++;
+		}
+
+		printf("%-5u %14.0f %14.0f %12.3g %12.3g %10u\n", z,
+			ROUNDS * NR_COORDS / scalar_t,
+			ROUNDS * NR_COORDS / batch_t,
+			max_lat_err, max_lng_err, mismatches);
+	}
+
+	t = now();
+	for (r=0;r<ROUNDS;r++) {
+		for (i=0;i<NR_COORDS;i++) {
+			coord_to_tile(lat[i], lng[i], 10, &c1[i], &c2[i]);
+		}
+		sink += c1[r].x;
+	}
+	scalar_t = now() - t;
+
+	t = now();
+	for (r=0;r<ROUNDS;r++) {
+		coord_to_tile_batch(10, lat, lng, NR_COORDS, c1, c2);
+		sink += c1[r].x;
+	}
+	batch_t = now() - t;
+
+	printf("coord_to_tile: scalar %.0f conv/s, batch %.0f conv/s\n",
+		ROUNDS * NR_COORDS / scalar_t, ROUNDS * NR_COORDS / batch_t);
+
+	free(tiles);
+	free(c1);
+	free(c2);
+	free(lat);
+	free(lng);
+	free(blat);
+	free(blng);
+
+	return (sink == 0.12345 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/* EOF */
@@ -0,0 +1,200 @@
+/* bench-e2e.c */
+
+/* Runs gmaps-trafficker on a capture file made by gen-traffic and
+   reports its throughput and peak memory use, and how well the estimated
+   locations match the ground truth of the path. The packet and flow
+   counts come from the statistics file gmaps-trafficker writes at exit,
+   the estimates from its output. An estimate is right when it is within
+   the tolerance of the step of the path closest to it. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+
+#define MAX_STEPS	1024
+
+struct step {
+	double lat;
+	double lng;
+	double tol;
+	uint32_t located;
+};
+
+static struct step steps[MAX_STEPS];
+static uint32_t nr_steps = 0;
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+read_truth(const char * fn)
+{
+	unsigned long long first, last;
+	struct step * s;
+	char line[256];
+	unsigned int z;
+	FILE * fp;
+
+	fp = fopen(fn, "r");
+	if (!fp) fatal("Cannot open the ground truth file.");
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#') continue;
+		if (nr_steps == MAX_STEPS) fatal("Too many steps.");
+		s = &(steps[nr_steps]);
+		if (sscanf(line, "%llu %llu %lf %lf %u %lf", &first, &last,
+				&(s->lat), &(s->lng), &z, &(s->tol)) != 6)
+			fatal("Cannot parse the ground truth file.");
+		s->located = 0;
+		nr_steps++;
+	}
+
+	fclose(fp);
+	if (!nr_steps) fatal("No steps in the ground truth file.");
+}
+
+static uint64_t
+read_stat(const char * fn, const char * name)
+{
+	unsigned long long value;
+	char line[256], key[128];
+	FILE * fp;
+
+	fp = fopen(fn, "r");
+	if (!fp) return 0;
+
+	value = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%127s %llu", key, &value) == 2 &&
+				!strcmp(key, name))
+			break;
+		value = 0;
+	}
+
+	fclose(fp);
+	return value;
+}
+
+/* Returns 1 if the estimate is within the tolerance of the closest
+   step. */
+static int
+match_estimate(double lat, double lng)
+{
+	double d, best;
+	uint32_t i, closest;
+
+	best = INFINITY;
+	closest = 0;
+	for (i=0;i<nr_steps;i++) {
+		d = fmax(fabs(lat - steps[i].lat), fabs(lng - steps[i].lng));
+		if (d < best) {
+			best = d;
+			closest = i;
+		}
+	}
+
+	if (best > steps[closest].tol) return 0;
+	steps[closest].located++;
+	return 1;
+}
+
+int
+main(int argc, char ** argv, char ** envp)
+{
+	uint32_t estimates, empty, right, located, i;
+	uint64_t packets, flows;
+	double lat, lng, start, elapsed;
+	struct rusage ru;
+	char line[1024], * p;
+	int fds[2], status;
+	pid_t pid;
+	FILE * fp;
+
+	if (argc < 4) {
+		fprintf(stderr, "%s <truth> <statsfile> <command> [args]\n",
+			argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	read_truth(argv[1]);
+	unlink(argv[2]);
+
+	if (pipe(fds) < 0) fatal("Cannot create pipe.");
+
+	start = now();
+	pid = fork();
+	if (pid < 0) fatal("Cannot fork.");
+	if (!pid) {
+		close(fds[0]);
+		if (dup2(fds[1], STDOUT_FILENO) < 0) _exit(EXIT_FAILURE);
+		close(fds[1]);
+		execvp(argv[3], argv + 3);
+		perror(argv[3]);
+		_exit(EXIT_FAILURE);
+	}
+	close(fds[1]);
+
+	fp = fdopen(fds[0], "r");
+	if (!fp) fatal("Cannot read the output.");
+
+	estimates = empty = right = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		p = strstr(line, "Lat: ");
+		if (!p || sscanf(p, "Lat: %lf, Lng: %lf", &lat, &lng) != 2)
+			continue;
+		if (isnan(lat) || isnan(lng)) {
+			empty++;
+			continue;
+		}
+		estimates++;
+		right += match_estimate(lat, lng);
+	}
+	fclose(fp);
+
+	if (waitpid(pid, &status, 0) < 0) fatal("Cannot wait for child.");
+	elapsed = now() - start;
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "%s failed\n", argv[3]);
+		exit(EXIT_FAILURE);
+	}
+	getrusage(RUSAGE_CHILDREN, &ru);
+
+	packets = read_stat(argv[2], "packets");
+	flows = read_stat(argv[2], "flows");
+
+	located = 0;
+	for (i=0;i<nr_steps;i++) {
+		if (steps[i].located) located++;
+	}
+
+	printf("elapsed           %10.3f s\n", elapsed);
+	printf("peak RSS          %10ld kB\n", ru.ru_maxrss);
+	printf("packets           %10llu  %12.0f/s\n",
+		(unsigned long long)packets, packets / elapsed);
+	printf("flows             %10llu  %12.0f/s\n",
+		(unsigned long long)flows, flows / elapsed);
+	printf("estimates         %10u  %12.1f/s  (%u windows without)\n",
+		estimates, estimates / elapsed, empty);
+	printf("estimates right   %10u  of %u\n", right, estimates);
+	printf("steps located     %10u  of %u\n", located, nr_steps);
+
+	return 0;
+}
+
+/* EOF */
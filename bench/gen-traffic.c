@@ -0,0 +1,871 @@
+/* gen-traffic.c */
+
+/* Generates a capture file of synthetic Google Maps traffic. A number of
+   clients follow a scripted path of viewports and fetch the tiles of
+   every viewport over new TLS connections, each response carries
+   application data as big as the tile in the profile plus some HTTP
+   headers. Background flows are mixed in and segments can get lost (the
+   retransmission shows up later) or reordered. The ground truth of every
+   step of the path is written out for bench-e2e to compare the
+   estimates of gmaps-trafficker with.
+
+   The path file has a line "lat lng zoom seconds" per step, the zoom
+   level counts the way the profile does (0 is the most detailed). */
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gmaps.h"
+#include "bitmap.h"
+
+#define MAX_STEPS		1024
+#define MAX_VIEW		16
+
+/* every client fetches the tiles of a viewport over this many
+   connections */
+#define CONNS_PER_CLIENT	4
+
+/* servers are 192.0.2.1 and up, the background flows that aren't
+   towards them go to 198.51.100.1 and the clients are in 10.0.0.0/8 */
+#define SERVERS			4
+#define SERVER_ADDR		0xc0000201
+#define OTHER_ADDR		0xc6336401
+#define CLIENT_ADDR		0x0a000001
+
+#define START_TS		1500000000ULL
+#define USEC			1000000ULL
+
+#define MSS			1448
+#define WINDOW			65535
+#define MAX_RECORD_LEN		16384
+
+/* responses stay below the receive window, there's no window scaling */
+#define MAX_RESPONSE_LEN	60000
+
+#define REQUEST_MIN_LEN		400
+#define REQUEST_MAX_LEN		900
+#define HEADER_MIN_LEN		200
+#define HEADER_MAX_LEN		500
+
+/* timing in microseconds */
+#define SEGMENT_GAP		12
+#define ACK_DELAY		40
+#define RTO			200000
+#define MIN_RTT			10000
+#define MAX_RTT			80000
+#define MAX_THINK		20000
+#define CLIENT_JITTER		300000
+#define CLOSE_DELAY		50000
+
+/* tiles around the viewports that go into a synthetic profile */
+#define PROFILE_MARGIN		8
+
+#define TH_FIN			0x01
+#define TH_SYN			0x02
+#define TH_PUSH			0x08
+#define TH_ACK			0x10
+
+#define BG_TLS			0
+#define BG_PLAIN		1
+#define BG_OTHER		2
+#define BG_TYPES		3
+
+struct step {
+	double lat;
+	double lng;
+	uint32_t z;
+	uint32_t secs;
+	struct coord tl;
+	uint32_t sizes[MAX_VIEW * MAX_VIEW];
+};
+
+struct pkt {
+	uint64_t ts;
+	uint64_t order;
+	size_t off;
+	uint32_t len;
+};
+
+struct flow {
+	uint32_t caddr;
+	uint32_t saddr;
+	uint16_t cport;
+	uint16_t sport;
+	uint32_t seq[2];
+	uint16_t ipid[2];
+	uint32_t rtt;
+};
+
+static struct step steps[MAX_STEPS];
+static uint32_t nr_steps = 0;
+static uint32_t view_w = 4, view_h = 3;
+
+static uint32_t seed = 1;
+static double loss = 0.0, reorder = 0.0;
+
+static struct pkt * pkts = NULL;
+static uint32_t nr_pkts = 0, pkts_alloc = 0;
+static unsigned char * arena = NULL;
+static size_t arena_len = 0, arena_alloc = 0;
+static uint64_t pkt_order = 0;
+
+static unsigned char filler[MAX_RESPONSE_LEN + 1024];
+
+static uint64_t packets_written = 0, bytes_written = 0;
+static uint64_t flows = 0, tile_flows = 0, tiles = 0, tiles_missing = 0;
+static uint64_t segments_lost = 0, segments_reordered = 0;
+
+static uint32_t
+rnd(uint32_t n)
+{
+	return (n ? (uint32_t)random() % n : 0);
+}
+
+static int
+chance(double percent)
+{
+	return (random() < percent / 100.0 * RAND_MAX);
+}
+
+static uint16_t
+checksum(uint32_t sum, const unsigned char * p, size_t len)
+{
+	while (len > 1) {
+		sum += (p[0] << 8) | p[1];
+		p += 2;
+		len -= 2;
+	}
+	if (len) sum += p[0] << 8;
+	while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)(~sum);
+}
+
+static void
+put16(unsigned char * p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+static void
+put32(unsigned char * p, uint32_t v)
+{
+	put16(p, v >> 16);
+	put16(p + 2, v & 0xffff);
+}
+
+static unsigned char *
+pkt_new(uint64_t ts, uint32_t len)
+{
+	struct pkt * p;
+
+	if (nr_pkts == pkts_alloc) {
+		pkts_alloc = (pkts_alloc ? pkts_alloc * 2 : 4096);
+		pkts = realloc(pkts, sizeof(struct pkt) * pkts_alloc);
+		if (!pkts) fatal("Out of memory.");
+	}
+	if (arena_len + len > arena_alloc) {
+		arena_alloc = (arena_alloc ? arena_alloc * 2 : 1024 * 1024);
+		while (arena_len + len > arena_alloc) arena_alloc *= 2;
+		arena = realloc(arena, arena_alloc);
+		if (!arena) fatal("Out of memory.");
+	}
+
+	p = &(pkts[nr_pkts++]);
+	p->ts = ts;
+	p->order = pkt_order++;
+	p->off = arena_len;
+	p->len = len;
+	arena_len += len;
+	return arena + p->off;
+}
+
+/* Adds an Ethernet/IPv4/TCP packet from one side of the flow. */
+static void
+add_segment(struct flow * f, int from_client, uint8_t flags, uint32_t seq,
+	uint32_t ack, const unsigned char * data, uint32_t len, uint64_t ts)
+{
+	unsigned char * p, * ip, * tcp, pseudo[12];
+	uint32_t sum;
+	int side = !from_client;
+
+	p = pkt_new(ts, 14 + 20 + 20 + len);
+	memset(p, 0, 14 + 20 + 20);
+	p[0] = p[6] = 0x02;
+	p[5] = (from_client ? 0x02 : 0x01);
+	p[11] = (from_client ? 0x01 : 0x02);
+	put16(p + 12, 0x0800);
+
+	ip = p + 14;
+	ip[0] = 0x45;
+	put16(ip + 2, 20 + 20 + len);
+	put16(ip + 4, f->ipid[side]++);
+	ip[6] = 0x40;
+	ip[8] = 64;
+	ip[9] = 6;
+	put32(ip + 12, (from_client ? f->caddr : f->saddr));
+	put32(ip + 16, (from_client ? f->saddr : f->caddr));
+	put16(ip + 10, checksum(0, ip, 20));
+
+	tcp = ip + 20;
+	put16(tcp, (from_client ? f->cport : f->sport));
+	put16(tcp + 2, (from_client ? f->sport : f->cport));
+	put32(tcp + 4, seq);
+	put32(tcp + 8, (flags & TH_ACK ? ack : 0));
+	tcp[12] = 0x50;
+	tcp[13] = flags;
+	put16(tcp + 14, WINDOW);
+	if (len) memcpy(tcp + 20, data, len);
+
+	memcpy(pseudo, ip + 12, 8);
+	pseudo[8] = 0;
+	pseudo[9] = 6;
+	put16(pseudo + 10, 20 + len);
+	sum = (uint16_t)~checksum(0, pseudo, sizeof(pseudo));
+	put16(tcp + 16, checksum(sum, tcp, 20 + len));
+}
+
+/* Sends len bytes from one side of the flow as back to back segments
+   starting at ts. Lost segments only show up as their retransmission,
+   reordered ones a few segments later. The other side acknowledges
+   every second segment as far as everything before it arrived, so a
+   retransmission is never acknowledged before it shows up. Returns the
+   time everything was acknowledged. */
+static uint64_t
+send_data(struct flow * f, int from_client, const unsigned char * data,
+	uint32_t len, uint64_t ts)
+{
+	uint64_t * arrival, t, last;
+	uint32_t base, off, n, i, nr, acked;
+	int side = !from_client;
+
+	nr = (len + MSS - 1) / MSS;
+	arrival = xmalloc(sizeof(uint64_t) * nr);
+
+	base = f->seq[side];
+	last = ts;
+	for (i=0,off=0;off<len;i++,off+=n) {
+		n = (len - off > MSS ? MSS : len - off);
+		t = ts + i * SEGMENT_GAP;
+		if (chance(loss)) {
+			t += RTO;
+			segments_lost++;
+		}
+		else if (chance(reorder)) {
+			t += (2 + rnd(3)) * SEGMENT_GAP;
+			segments_reordered++;
+		}
+		add_segment(f, from_client, TH_ACK | (off + n == len ?
+			TH_PUSH : 0), base + off, f->seq[!side],
+			data + off, n, t);
+		arrival[i] = t;
+		if (t > last) last = t;
+	}
+	f->seq[side] = base + len;
+
+	for (i=1;i<nr;i+=2) {
+		t = arrival[i] + ACK_DELAY;
+		if (t > last) continue;
+		for (acked=0;acked<nr && arrival[acked]<=t;acked++);
+		if (!acked) continue;
+		add_segment(f, !from_client, TH_ACK, f->seq[!side],
+			(acked == nr ? base + len : base + acked * MSS),
+			NULL, 0, t);
+	}
+	last += ACK_DELAY;
+	add_segment(f, !from_client, TH_ACK, f->seq[!side], base + len,
+		NULL, 0, last);
+
+	free(arrival);
+	return last;
+}
+
+/* Fills buf with TLS records of the given type carrying len bytes in
+   total, returns the length of the records. */
+static uint32_t
+tls_records(unsigned char * buf, uint8_t type, uint32_t len)
+{
+	uint32_t n, out = 0;
+
+	while (len) {
+		n = (len > MAX_RECORD_LEN ? MAX_RECORD_LEN : len);
+		buf[out] = type;
+		buf[out + 1] = 3;
+		buf[out + 2] = 3;
+		put16(buf + out + 3, n);
+		memcpy(buf + out + 5, filler, n);
+		out += 5 + n;
+		len -= n;
+	}
+	return out;
+}
+
+static void
+flow_init(struct flow * f, uint32_t caddr, uint16_t cport, uint32_t saddr,
+	uint32_t rtt)
+{
+	f->caddr = caddr;
+	f->saddr = saddr;
+	f->cport = cport;
+	f->sport = 443;
+	f->seq[0] = random();
+	f->seq[1] = random();
+	f->ipid[0] = random();
+	f->ipid[1] = random();
+	f->rtt = rtt;
+	flows++;
+}
+
+static uint64_t
+flow_connect(struct flow * f, uint64_t ts)
+{
+	add_segment(f, 1, TH_SYN, f->seq[0]++, 0, NULL, 0, ts);
+	ts += f->rtt;
+	add_segment(f, 0, TH_SYN | TH_ACK, f->seq[1]++, f->seq[0], NULL, 0,
+		ts);
+	add_segment(f, 1, TH_ACK, f->seq[0], f->seq[1], NULL, 0, ts);
+	return ts;
+}
+
+/* The client hello, the server hello with the certificates, the key
+   exchange and both finished messages. */
+static uint64_t
+tls_handshake(struct flow * f, uint64_t ts)
+{
+	static unsigned char buf[8192];
+	uint32_t len;
+
+	len = tls_records(buf, 22, 250 + rnd(250));
+	ts = send_data(f, 1, buf, len, ts);
+	len = tls_records(buf, 22, 2500 + rnd(1500));
+	ts = send_data(f, 0, buf, len, ts + f->rtt);
+	len = tls_records(buf, 22, 70);
+	len += tls_records(buf + len, 20, 1);
+	len += tls_records(buf + len, 22, 40);
+	ts = send_data(f, 1, buf, len, ts);
+	len = tls_records(buf, 20, 1);
+	len += tls_records(buf + len, 22, 40);
+	return send_data(f, 0, buf, len, ts + f->rtt);
+}
+
+/* One request with an application data response of reslen bytes. */
+static uint64_t
+tls_exchange(struct flow * f, uint32_t reslen, uint64_t ts)
+{
+	static unsigned char buf[MAX_RESPONSE_LEN + 1024];
+	uint32_t len;
+
+	len = tls_records(buf, 23, REQUEST_MIN_LEN +
+		rnd(REQUEST_MAX_LEN - REQUEST_MIN_LEN));
+	ts = send_data(f, 1, buf, len, ts);
+	len = tls_records(buf, 23, reslen);
+	return send_data(f, 0, buf, len, ts + f->rtt + rnd(MAX_THINK));
+}
+
+/* A plain HTTP request and response, the port is the same as for the
+   TLS flows. */
+static uint64_t
+plain_exchange(struct flow * f, uint32_t reslen, uint64_t ts)
+{
+	static const char request[] = "GET / HTTP/1.1\r\nHost: x\r\n\r\n";
+	static const char response[] = "HTTP/1.1 200 OK\r\n";
+	static unsigned char buf[MAX_RESPONSE_LEN];
+
+	memcpy(buf, request, strlen(request));
+	ts = send_data(f, 1, buf, strlen(request), ts);
+	memset(buf, 'x', reslen);
+	memcpy(buf, response, strlen(response));
+	return send_data(f, 0, buf, reslen, ts + f->rtt + rnd(MAX_THINK));
+}
+
+static void
+flow_close(struct flow * f, uint64_t ts)
+{
+	add_segment(f, 1, TH_FIN | TH_ACK, f->seq[0]++, f->seq[1], NULL, 0,
+		ts);
+	ts += f->rtt;
+	add_segment(f, 0, TH_FIN | TH_ACK, f->seq[1]++, f->seq[0], NULL, 0,
+		ts);
+	add_segment(f, 1, TH_ACK, f->seq[0], f->seq[1], NULL, 0, ts);
+}
+
+static uint32_t * client_rtt;
+static uint16_t * client_port;
+static uint32_t nr_clients = 1;
+
+static uint16_t
+next_port(uint32_t client)
+{
+	if (client_port[client] < 32768 || client_port[client] >= 60999)
+		client_port[client] = 32768;
+	return client_port[client]++;
+}
+
+/* A client fetches the tiles of the viewport of a step in random order
+   over several connections. */
+static void
+gen_client(uint32_t client, struct step * s, uint64_t start)
+{
+	uint32_t order[MAX_VIEW * MAX_VIEW], n, i, j, c, tmp;
+	struct flow f;
+	uint64_t ts;
+
+	n = view_w * view_h;
+	for (i=0;i<n;i++) order[i] = i;
+	for (i=n-1;i>0;i--) {
+		j = rnd(i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	start += rnd(CLIENT_JITTER);
+	for (c=0;c<CONNS_PER_CLIENT && c<n;c++) {
+		flow_init(&f, CLIENT_ADDR + client, next_port(client),
+			SERVER_ADDR + rnd(SERVERS), client_rtt[client]);
+		tile_flows++;
+		ts = flow_connect(&f, start + c * 1000);
+		ts = tls_handshake(&f, ts);
+		for (i=c;i<n;i+=CONNS_PER_CLIENT) {
+			ts = tls_exchange(&f, s->sizes[order[i]] +
+				HEADER_MIN_LEN +
+				rnd(HEADER_MAX_LEN - HEADER_MIN_LEN), ts);
+			ts += rnd(2000);
+		}
+		flow_close(&f, ts + CLOSE_DELAY);
+	}
+}
+
+/* Background flows start anywhere within the step: TLS flows to the
+   servers with responses of any size, plain HTTP flows to the servers
+   and TLS flows to other hosts. */
+static void
+gen_background(uint32_t nr, uint64_t start, uint32_t secs)
+{
+	uint32_t i, n, type, client;
+	struct flow f;
+	uint64_t ts;
+
+	for (i=0;i<nr;i++) {
+		ts = start + rnd(secs * USEC);
+		type = rnd(BG_TYPES);
+		client = rnd(nr_clients);
+		flow_init(&f, CLIENT_ADDR + client, next_port(client),
+			(type == BG_OTHER ? OTHER_ADDR : SERVER_ADDR) +
+			rnd(SERVERS), client_rtt[client]);
+		ts = flow_connect(&f, ts);
+		if (type == BG_PLAIN) {
+			ts = plain_exchange(&f, 1000 + rnd(20000), ts);
+		}
+		else {
+			ts = tls_handshake(&f, ts);
+			for (n=1+rnd(3);n>0;n--) {
+				ts = tls_exchange(&f, 100 +
+					rnd(MAX_RESPONSE_LEN - 100), ts);
+			}
+		}
+		flow_close(&f, ts + CLOSE_DELAY);
+	}
+}
+
+static int
+pkt_compare(const void * a, const void * b)
+{
+	const struct pkt * p1 = a, * p2 = b;
+
+	if (p1->ts != p2->ts) return (p1->ts < p2->ts ? -1 : 1);
+	return (p1->order < p2->order ? -1 : (p1->order > p2->order));
+}
+
+/* Writes out the packets from before ts in capture order, the others
+   are kept for the next round. */
+static void
+flush_packets(FILE * fp, uint64_t ts)
+{
+	unsigned char * keep;
+	uint32_t hdr[4], i, j;
+	size_t len;
+
+	qsort(pkts, nr_pkts, sizeof(struct pkt), pkt_compare);
+
+	for (i=0;i<nr_pkts && pkts[i].ts < ts;i++) {
+		hdr[0] = pkts[i].ts / USEC;
+		hdr[1] = pkts[i].ts % USEC;
+		hdr[2] = hdr[3] = pkts[i].len;
+		if (fwrite(hdr, sizeof(hdr), 1, fp) != 1 ||
+				fwrite(arena + pkts[i].off, pkts[i].len,
+				1, fp) != 1)
+			fatal("Cannot write the capture file.");
+		packets_written++;
+		bytes_written += pkts[i].len;
+	}
+
+	keep = xmalloc(arena_alloc);
+	for (j=0,len=0;i<nr_pkts;i++,j++) {
+		memcpy(keep + len, arena + pkts[i].off, pkts[i].len);
+		pkts[j] = pkts[i];
+		pkts[j].off = len;
+		len += pkts[i].len;
+	}
+	free(arena);
+	arena = keep;
+	arena_len = len;
+	nr_pkts = j;
+}
+
+static void
+read_path(const char * fn)
+{
+	struct step * s;
+	struct coord off;
+	char line[256];
+	FILE * fp;
+
+	fp = fopen(fn, "r");
+	if (!fp) fatal("Cannot open the path file.");
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[strspn(line, " \t")] == '#' ||
+				line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+		if (nr_steps == MAX_STEPS) fatal("Too many steps in the path.");
+		s = &(steps[nr_steps++]);
+		memset(s, 0, sizeof(struct step));
+		if (sscanf(line, "%lf %lf %u %u", &(s->lat), &(s->lng),
+				&(s->z), &(s->secs)) != 4)
+			fatal("Cannot parse the path file.");
+		if (s->z > 17 || !s->secs || s->secs > 3600)
+			fatal("Invalid step in the path file.");
+
+		/* the viewport is centered on the coordinate */
+		coord_to_tile(s->lat, s->lng, s->z, &(s->tl), &off);
+		s->tl.x = (s->tl.x > view_w / 2 ? s->tl.x - view_w / 2 : 0);
+		s->tl.y = (s->tl.y > view_h / 2 ? s->tl.y - view_h / 2 : 0);
+	}
+
+	fclose(fp);
+	if (!nr_steps) fatal("No steps in the path file.");
+}
+
+static uint32_t
+synthetic_size(uint32_t x, uint32_t y, uint32_t z)
+{
+	uint32_t h;
+
+	h = (seed ^ x) * 0x9e3779b1;
+	h = (h ^ y) * 0x85ebca6b;
+	h = (h ^ z) * 0xc2b2ae35;
+	h ^= h >> 16;
+	return MIN_TILE_LEN + h % (MAX_TILE_LEN - HEADER_MAX_LEN -
+		MIN_TILE_LEN);
+}
+
+/* Makes up a profile with random tile sizes for the area around the
+   viewports of the path and saves it. */
+static struct profile *
+make_profile(const char * fn)
+{
+	struct bitmap * done[MAX_Z];
+	struct profile * profile;
+	struct profile_entry pe;
+	struct step * s;
+	uint32_t i, x, y, x0, y0, x1, y1, world;
+
+	profile = profile_new();
+	if (!profile) fatal("Out of memory.");
+	memset(done, 0, sizeof(done));
+
+	for (i=0;i<nr_steps;i++) {
+		s = &(steps[i]);
+		world = tiles_on_level(s->z);
+		if (!done[s->z]) {
+			done[s->z] = bitmap_new();
+			if (!done[s->z]) fatal("Out of memory.");
+		}
+		x0 = (s->tl.x > PROFILE_MARGIN ? s->tl.x - PROFILE_MARGIN : 0);
+		y0 = (s->tl.y > PROFILE_MARGIN ? s->tl.y - PROFILE_MARGIN : 0);
+		x1 = s->tl.x + view_w + PROFILE_MARGIN;
+		y1 = s->tl.y + view_h + PROFILE_MARGIN;
+		if (x1 > world) x1 = world;
+		if (y1 > world) y1 = world;
+		for (x=x0;x<x1;x++) {
+			for (y=y0;y<y1;y++) {
+				if (bitmap_test(done[s->z], x, y)) continue;
+				if (bitmap_set(done[s->z], x, y) < 0)
+					fatal("Out of memory.");
+				pe.x = x;
+				pe.y = y;
+				pe.z = s->z;
+				pe.id = 0;
+				if (profile_add(profile,
+						synthetic_size(x, y, s->z),
+						&pe) < 0)
+					fatal("Out of memory.");
+			}
+		}
+	}
+
+	for (i=0;i<MAX_Z;i++) {
+		if (done[i]) bitmap_free(done[i]);
+	}
+
+	if (profile_save(profile, fn, 1) < 0)
+		fatal("Cannot write the profile.");
+	return profile;
+}
+
+/* Looks up the sizes of the tiles in the viewports, the ones missing
+   from the profile get a random size. */
+static void
+lookup_sizes(struct profile * profile)
+{
+	struct profile_entry pe;
+	struct list * list;
+	struct step * s;
+	uint32_t sz, i, j, c, missing;
+
+	for (sz=1;sz<=MAX_RESPONSE_LEN-HEADER_MAX_LEN;sz++) {
+		list = profile_get(profile, sz);
+		if (!list) continue;
+		c = list_count(list);
+		for (j=0;j<c;j++) {
+			list_get(list, j, &pe);
+			for (i=0;i<nr_steps;i++) {
+				s = &(steps[i]);
+				if (pe.z != s->z || pe.x < s->tl.x ||
+						pe.x >= s->tl.x + view_w ||
+						pe.y < s->tl.y ||
+						pe.y >= s->tl.y + view_h)
+					continue;
+				s->sizes[(pe.y - s->tl.y) * view_w +
+					pe.x - s->tl.x] = sz;
+			}
+		}
+	}
+
+	for (i=0;i<nr_steps;i++) {
+		s = &(steps[i]);
+		missing = 0;
+		for (j=0;j<view_w*view_h;j++) {
+			tiles++;
+			if (s->sizes[j]) continue;
+			s->sizes[j] = MIN_TILE_LEN +
+				rnd(MAX_TILE_LEN - HEADER_MAX_LEN - MIN_TILE_LEN);
+			missing++;
+		}
+		if (missing) {
+			fprintf(stderr, "Step %u: %u of %u tiles not in the "
+				"profile\n", i, missing, view_w * view_h);
+		}
+		tiles_missing += missing;
+	}
+}
+
+/* Writes a line per step with its time range, the center of its
+   viewport and how far the estimate may be off from it, which is half
+   the viewport. */
+static void
+write_truth(const char * fn)
+{
+	double lat0, lng0, lat1, lng1;
+	struct coord c;
+	struct step * s;
+	uint64_t ts;
+	uint32_t i;
+	FILE * fp;
+
+	fp = fopen(fn, "w");
+	if (!fp) fatal("Cannot write the ground truth file.");
+
+	fprintf(fp, "# first_ts last_ts lat lng zoom tolerance\n");
+	ts = START_TS;
+	for (i=0;i<nr_steps;i++) {
+		s = &(steps[i]);
+		tile_to_coord(s->z, &(s->tl), 0, 0, &lat0, &lng0);
+		c.x = s->tl.x + view_w;
+		c.y = s->tl.y + view_h;
+		tile_to_coord(s->z, &c, 0, 0, &lat1, &lng1);
+		fprintf(fp, "%llu %llu %lf %lf %u %lf\n",
+			(unsigned long long)ts,
+			(unsigned long long)ts + s->secs - 1,
+			(lat0 + lat1) / 2, (lng0 + lng1) / 2, s->z,
+			(lat0 - lat1 > lng1 - lng0 ? lat0 - lat1 :
+			lng1 - lng0) / 2);
+		ts += s->secs;
+	}
+
+	fclose(fp);
+}
+
+static void
+write_servers(const char * fn)
+{
+	struct in_addr in;
+	uint32_t i;
+	FILE * fp;
+
+	fp = fopen(fn, "w");
+	if (!fp) fatal("Cannot write the server list.");
+	for (i=0;i<SERVERS;i++) {
+		in.s_addr = htonl(SERVER_ADDR + i);
+		fprintf(fp, "%s\n", inet_ntoa(in));
+	}
+	fclose(fp);
+}
+
+static void
+usage(const char * arg0)
+{
+	fprintf(stderr, "%s -p <path> -o <pcap> [options]\n", arg0);
+	fprintf(stderr, "Generate synthetic Google Maps traffic for a path");
+	fprintf(stderr, " of viewports.\n\n");
+	fprintf(stderr, "-p <path>      - path file, a line 'lat lng zoom");
+	fprintf(stderr, " seconds' per step\n");
+	fprintf(stderr, "-o <pcap>      - capture file to write\n");
+	fprintf(stderr, "-f <profile>   - profile to take the tile sizes");
+	fprintf(stderr, " from\n");
+	fprintf(stderr, "-P <profile>   - make up a profile around the path");
+	fprintf(stderr, " and write it here\n");
+	fprintf(stderr, "-t <truth>     - write the ground truth here\n");
+	fprintf(stderr, "-i <iplist>    - write the server addresses here\n");
+	fprintf(stderr, "-c <clients>   - clients following the path");
+	fprintf(stderr, " (default: 1)\n");
+	fprintf(stderr, "-b <flows>     - background flows per step");
+	fprintf(stderr, " (default: 0)\n");
+	fprintf(stderr, "-l <percent>   - segments lost and retransmitted\n");
+	fprintf(stderr, "-r <percent>   - segments reordered\n");
+	fprintf(stderr, "-V <w>x<h>     - viewport in tiles (default: 4x3)\n");
+	fprintf(stderr, "-s <seed>      - random seed (default: 1)\n");
+	fprintf(stderr, "-h             - usage information\n");
+}
+
+int
+main(int argc, char ** argv, char ** envp)
+{
+	const char * pathfn = NULL, * outfn = NULL, * profilefn = NULL;
+	const char * newprofilefn = NULL, * truthfn = NULL, * ipfn = NULL;
+	struct profile * profile;
+	uint32_t i, c, background = 0, pcaphdr[6];
+	uint64_t ts;
+	FILE * fp;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hp:o:f:P:t:i:c:b:l:r:V:s:")) != -1) {
+		switch (opt) {
+			case 'p':
+				pathfn = optarg;
+				break;
+			case 'o':
+				outfn = optarg;
+				break;
+			case 'f':
+				profilefn = optarg;
+				break;
+			case 'P':
+				newprofilefn = optarg;
+				break;
+			case 't':
+				truthfn = optarg;
+				break;
+			case 'i':
+				ipfn = optarg;
+				break;
+			case 'c':
+				nr_clients = strtoul(optarg, NULL, 10);
+				break;
+			case 'b':
+				background = strtoul(optarg, NULL, 10);
+				break;
+			case 'l':
+				loss = strtod(optarg, NULL);
+				break;
+			case 'r':
+				reorder = strtod(optarg, NULL);
+				break;
+			case 'V':
+				if (sscanf(optarg, "%ux%u", &view_w,
+						&view_h) != 2)
+					view_w = 0;
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!pathfn || !outfn || (!profilefn == !newprofilefn)) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (!view_w || !view_h || view_w > MAX_VIEW || view_h > MAX_VIEW)
+		fatal("Invalid viewport size.");
+	if (!nr_clients || nr_clients > (1 << 20))
+		fatal("Invalid number of clients.");
+
+	srandom(seed);
+	for (i=0;i<sizeof(filler);i++) filler[i] = random();
+
+	read_path(pathfn);
+	if (newprofilefn) profile = make_profile(newprofilefn);
+	else profile = profile_load(profilefn);
+	if (!profile) fatal("Cannot load the profile.");
+	lookup_sizes(profile);
+	profile_unload(profile);
+
+	client_rtt = xmalloc(sizeof(uint32_t) * nr_clients);
+	client_port = xmalloc(sizeof(uint16_t) * nr_clients);
+	for (c=0;c<nr_clients;c++) {
+		client_rtt[c] = MIN_RTT + rnd(MAX_RTT - MIN_RTT);
+		client_port[c] = 32768 + rnd(28000);
+	}
+
+	fp = fopen(outfn, "w");
+	if (!fp) fatal("Cannot write the capture file.");
+	pcaphdr[0] = 0xa1b2c3d4;
+	pcaphdr[1] = 2 | (4 << 16);
+	pcaphdr[2] = pcaphdr[3] = 0;
+	pcaphdr[4] = 65535;
+	pcaphdr[5] = 1;
+	if (fwrite(pcaphdr, sizeof(pcaphdr), 1, fp) != 1)
+		fatal("Cannot write the capture file.");
+
+	/* the packets of a step that run into the next one are written
+	   out together with that */
+	ts = START_TS * USEC;
+	for (i=0;i<nr_steps;i++) {
+		for (c=0;c<nr_clients;c++) gen_client(c, &(steps[i]), ts);
+		gen_background(background, ts, steps[i].secs);
+		ts += steps[i].secs * USEC;
+		flush_packets(fp, (i == nr_steps - 1 ? UINT64_MAX : ts));
+	}
+	fclose(fp);
+
+	if (truthfn) write_truth(truthfn);
+	if (ipfn) write_servers(ipfn);
+
+	printf("%u steps, %u clients, %llu flows (%llu with tiles), %llu "
+		"tiles (%llu not in the profile)\n", nr_steps, nr_clients,
+		(unsigned long long)flows, (unsigned long long)tile_flows,
+		(unsigned long long)tiles * nr_clients,
+		(unsigned long long)tiles_missing * nr_clients);
+	printf("%llu packets, %llu bytes, %llu segments lost, %llu "
+		"reordered\n", (unsigned long long)packets_written,
+		(unsigned long long)bytes_written,
+		(unsigned long long)segments_lost,
+		(unsigned long long)segments_reordered);
+
+	free(client_rtt);
+	free(client_port);
+	free(pkts);
+	free(arena);
+	return 0;
+}
+
+/* EOF */
@@ -0,0 +1,849 @@
+/* microbench.c */
+
+/* Microbenchmarks of the primitives every packet and every analysis
+   window goes through: the SSL record parser, the flow hash, the server
+   prefix lookup, the reassembly buffers and the map and list
+   containers. Every benchmark runs at a few input sizes on inputs made
+   from a fixed seed and reports the time, the cycles and the
+   allocations per operation, the best of a few rounds. The allocations
+   are counted by wrapping malloc() and friends at link time, see the
+   Makefile.
+
+   Results can be saved as JSON and compared against a saved baseline,
+   a benchmark that got slower by more than the threshold or allocates
+   more than before is flagged and makes the exit status non zero.
+
+   With -C the flow hash is checked instead: the given number of
+   distinct flows is hashed and the colliding pairs on the full hash and
+   on its low bits are counted against the number a random function
+   would give. With -T the throughput of the SSL record parser and of the
+   scanner libtrafficker uses is measured in GB/s instead. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+#endif
+
+#include "gmaps.h"
+#include "ssl.h"
+#include "buffer.h"
+#include "hash.h"
+#include "lpm.h"
+
+#define SEED			42
+#define ROUNDS			5
+
+/* a round runs at least this many nanoseconds */
+#define MIN_ROUND_NS		20000000ULL
+
+/* default threshold for regressions in percent */
+#define REGRESSION_THRESHOLD	10.0
+
+/* size of the hash tables of the map benchmarks */
+#define MAP_HASHSIZE		1009
+
+#define MAX_RESULTS		128
+#define MAX_NAME		64
+
+struct result {
+	char name[MAX_NAME];
+	uint64_t ops;
+	double ns;
+	double allocs;
+	double cycles;
+};
+
+struct bench {
+	const char * name;
+	uint32_t sizes[4];
+	void (*run)(uint32_t, uint64_t);
+};
+
+static struct result results[MAX_RESULTS];
+static uint32_t nr_results = 0;
+
+static volatile uint64_t sink;
+
+static int timing = 0;
+static uint64_t allocs, t_start, t_ns, c_start, c_cycles;
+
+void * __real_malloc(size_t);
+void * __real_calloc(size_t, size_t);
+void * __real_realloc(void *, size_t);
+
+void *
+__wrap_malloc(size_t len)
+{
+	if (timing) allocs++;
+	return __real_malloc(len);
+}
+
+void *
+__wrap_calloc(size_t n, size_t len)
+{
+	if (timing) allocs++;
+	return __real_calloc(n, len);
+}
+
+void *
+__wrap_realloc(void * p, size_t len)
+{
+	if (timing) allocs++;
+	return __real_realloc(p, len);
+}
+
+static uint64_t
+cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* The benchmarks do their setup, then time the operations between
+   these two calls. */
+static void
+timer_start()
+{
+	allocs = 0;
+	timing = 1;
+	c_start = cycles();
+	t_start = monotonic_ns();
+}
+
+static void
+timer_stop()
+{
+	t_ns = monotonic_ns() - t_start;
+	c_cycles = cycles() - c_start;
+	timing = 0;
+}
+
+/* Makes a stream of n records with a payload of size bytes, every
+   fourth is a handshake record and the others carry application
+   data. */
+static char *
+make_records(uint32_t size, uint32_t n)
+{
+	uint32_t i, reclen;
+	char * buf, * p;
+
+	reclen = size + 5;
+	buf = xmalloc((size_t)n * reclen);
+	for (i=0;i<n;i++) {
+		p = buf + (size_t)i * reclen;
+		p[0] = (i % 4 ? SSL_MSG_APPLICATION_DATA : SSL_MSG_HANDSHAKE);
+		p[1] = 3;
+		p[2] = 3;
+		p[3] = size >> 8;
+		p[4] = size & 0xff;
+		memset(p + 5, i, size);
+	}
+	return buf;
+}
+
+/* Scans the stream in segments of seglen bytes the way libtrafficker
+   feeds it the reassembled data, until at least ops records were found.
+   Returns the number of bytes scanned. */
+static uint64_t
+scan_records(const char * buf, size_t len, size_t seglen, uint64_t ops)
+{
+	struct ssl_record records[64];
+	struct ssl_scan scan;
+	size_t off, seg, used, n;
+	uint64_t found, bytes;
+
+	ssl_scan_init(&scan);
+	found = bytes = 0;
+	off = 0;
+	while (found < ops) {
+		seg = (len - off < seglen ? len - off : seglen);
+		while (seg) {
+			n = ssl_scan(&scan, buf + off, seg, records, 64, &used);
+			if (scan.error) fatal("Unexpected error in ssl_scan");
+			if (n) sink += records[n - 1].len;
+			found += n;
+			off += used;
+			bytes += used;
+			seg -= used;
+		}
+		if (off == len) off = 0;
+	}
+	return bytes;
+}
+
+/* Parses records with a payload of size bytes, an operation is a
+   record. */
+static void
+bench_ssl_parse(uint32_t size, uint64_t ops)
+{
+	struct ssl_parse sslret;
+	uint32_t i, n, reclen;
+	char * buf, * p;
+	uint64_t op;
+
+	reclen = size + 5;
+	n = (1024 * 1024) / reclen + 1;
+	buf = make_records(size, n);
+
+	timer_start();
+	for (op=0,p=buf,i=0;op<ops;op++) {
+		if (ssl_parse(p, (size_t)(n - i) * reclen, &sslret) < 0)
+			fatal("Unexpected error in ssl_parse");
+		sink += sslret.data_len;
+		p += sslret.total_read;
+		if (++i == n) {
+			p = buf;
+			i = 0;
+		}
+	}
+	timer_stop();
+
+	free(buf);
+}
+
+/* Hashes the addresses of size different flows, an operation is a
+   hash. The key of the hash is random, only the flows come from the
+   seed. */
+/* Scans records with a payload of size bytes in segments of a full
+   sized packet, an operation is a record. */
+static void
+bench_ssl_scan(uint32_t size, uint64_t ops)
+{
+	uint32_t n;
+	char * buf;
+
+	n = (1024 * 1024) / (size + 5) + 1;
+	buf = make_records(size, n);
+
+	timer_start();
+	scan_records(buf, (size_t)n * (size + 5), 1448, ops);
+	timer_stop();
+
+	free(buf);
+}
+
+/* Reports the throughput of the record parser and of the scanner over
+   a stream of about mb megabytes, for a few record and segment sizes.
+   The parser gets the whole stream, which is its best case. */
+static void
+ssl_throughput(uint32_t mb)
+{
+	static const uint32_t sizes[] = { 64, 1448, 16384 };
+	static const size_t seglens[] = { 536, 1448, 65536 };
+	struct ssl_parse sslret;
+	uint64_t best[4], bytes, t;
+	uint32_t i, j, r, n;
+	size_t len, off;
+	char * buf;
+
+	printf("%u MB per round, best of %u rounds, GB/s\n\n", mb, ROUNDS);
+	printf("%8s %10s %14s %14s %14s\n", "record", "ssl_parse",
+		"ssl_scan/536", "ssl_scan/1448", "ssl_scan/64k");
+	for (i=0;i<sizeof(sizes)/sizeof(uint32_t);i++) {
+		n = ((uint64_t)mb * 1024 * 1024) / (sizes[i] + 5) + 1;
+		len = (size_t)n * (sizes[i] + 5);
+		buf = make_records(sizes[i], n);
+
+		memset(best, 0, sizeof(best));
+		for (r=0;r<ROUNDS;r++) {
+			t = monotonic_ns();
+			for (off=0;off<len;off+=sslret.total_read) {
+				if (ssl_parse(buf + off, len - off,
+						&sslret) < 0)
+					fatal("Unexpected error in ssl_parse");
+				sink += sslret.data_len;
+			}
+			t = monotonic_ns() - t;
+			if (!best[0] || t < best[0]) best[0] = t;
+
+			for (j=0;j<3;j++) {
+				t = monotonic_ns();
+				bytes = scan_records(buf, len, seglens[j], n);
+				t = monotonic_ns() - t;
+				if (bytes != len)
+					fatal("Scanned the wrong length.");
+				if (!best[j + 1] || t < best[j + 1])
+					best[j + 1] = t;
+			}
+		}
+
+		printf("%8u %10.2f %14.2f %14.2f %14.2f\n", sizes[i],
+			(double)len / best[0], (double)len / best[1],
+			(double)len / best[2], (double)len / best[3]);
+		fflush(stdout);
+		free(buf);
+	}
+}
+
+static void
+bench_mkhash(uint32_t size, uint64_t ops)
+{
+	uint32_t * addrs, i;
+	uint16_t * ports;
+	uint64_t op;
+
+	addrs = xmalloc(sizeof(uint32_t) * size * 2);
+	ports = xmalloc(sizeof(uint16_t) * size * 2);
+	for (i=0;i<size*2;i++) {
+		addrs[i] = random();
+		ports[i] = random();
+	}
+
+	timer_start();
+	for (op=0,i=0;op<ops;op++) {
+		sink += mkhash(addrs[2*i], ports[2*i], addrs[2*i+1],
+			ports[2*i+1]);
+		if (++i == size) i = 0;
+	}
+	timer_stop();
+
+	free(addrs);
+	free(ports);
+}
+
+static int
+u64compare(const void * a, const void * b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x < y ? -1 : (x > y));
+}
+
+/* Returns the number of colliding pairs among the hashes cut to their
+   low bits, the hashes are sorted in place. */
+static uint64_t
+count_collisions(uint64_t * h, uint32_t n, uint32_t bits)
+{
+	uint64_t pairs, run;
+	uint32_t i;
+
+	if (bits < 64) {
+		for (i=0;i<n;i++) h[i] &= (1ULL << bits) - 1;
+	}
+	qsort(h, n, sizeof(uint64_t), u64compare);
+
+	pairs = 0;
+	run = 1;
+	for (i=1;i<=n;i++) {
+		if (i < n && h[i] == h[i-1]) {
+			run++;
+			continue;
+		}
+		pairs += run * (run - 1) / 2;
+		run = 1;
+	}
+	return pairs;
+}
+
+/* Hashes n distinct flows the way they show up in a capture, lots of
+   clients with sequential addresses and ports talking to a few servers
+   on port 443, and reports the collisions per hash width. */
+static void
+hash_collisions(uint32_t n)
+{
+	static const uint32_t widths[] = { 64, 48, 32, 24 };
+	uint64_t * hashes, * h, pairs;
+	uint32_t i, w, chost, dhost;
+	uint16_t cport;
+	double expected;
+
+	hashes = xmalloc(sizeof(uint64_t) * n);
+	h = xmalloc(sizeof(uint64_t) * n);
+	for (i=0;i<n;i++) {
+		chost = 0x0a000000 + i / 28232;
+		cport = 32768 + i % 28232;
+		dhost = 0xc0000201 + i % 4;
+		hashes[i] = mkhash(chost, cport, dhost, 443);
+		if (hashes[i] != mkhash(dhost, 443, chost, cport))
+			fatal("The hash depends on the direction.");
+	}
+
+	printf("%u flows\n", n);
+	printf("%5s %14s %16s\n", "bits", "pairs", "random function");
+	for (w=0;w<sizeof(widths)/sizeof(uint32_t);w++) {
+		memcpy(h, hashes, sizeof(uint64_t) * n);
+		pairs = count_collisions(h, n, widths[w]);
+		expected = (double)n * (n - 1) / 2 / ldexp(1.0, widths[w]);
+		printf("%5u %14llu %16.1f\n", widths[w],
+			(unsigned long long)pairs, expected);
+	}
+
+	free(hashes);
+	free(h);
+}
+
+/* Looks up addresses in a table of size server prefixes of 12 to 32
+   bits, half of the addresses are in one of them. An operation is a
+   lookup. */
+static void
+bench_lpm_lookup(uint32_t size, uint64_t ops)
+{
+	uint32_t * addrs, * prefixes, i, len;
+	struct lpm * lpm;
+	uint64_t op;
+
+	lpm = lpm_new();
+	if (!lpm) fatal("Out of memory.");
+	prefixes = xmalloc(sizeof(uint32_t) * size);
+	for (i=0;i<size;i++) {
+		prefixes[i] = random();
+		len = 12 + random() % 21;
+		if (lpm_add(lpm, prefixes[i], len) < 0)
+			fatal("Unexpected error in lpm_add");
+	}
+	addrs = xmalloc(sizeof(uint32_t) * 65536);
+	for (i=0;i<65536;i++) {
+		addrs[i] = random();
+		if (i % 2) addrs[i] = prefixes[random() % size];
+	}
+
+	timer_start();
+	for (op=0,i=0;op<ops;op++) {
+		sink += lpm_lookup(lpm, addrs[i]);
+		i = (i + 1) & 0xffff;
+	}
+	timer_stop();
+
+	free(addrs);
+	free(prefixes);
+	lpm_free(lpm);
+}
+
+/* Appends chunks of size bytes the way segments get reassembled, the
+   buffer is reset once it holds a burst of 64kB. An operation is an
+   append. */
+static void
+bench_buffer_append(uint32_t size, uint64_t ops)
+{
+	struct buffer * b;
+	char * chunk;
+	uint64_t op;
+
+	chunk = xmalloc(size);
+	memset(chunk, 0x17, size);
+
+	timer_start();
+	b = buffer_new();
+	for (op=0;op<ops;op++) {
+		buffer_append(b, chunk, size);
+		if (b->len >= 64 * 1024) {
+			sink += b->len;
+			buffer_reset(b);
+		}
+	}
+	buffer_free(b);
+	timer_stop();
+
+	free(chunk);
+}
+
+static uint32_t *
+random_keys(uint32_t n)
+{
+	uint32_t * keys, i;
+
+	keys = xmalloc(sizeof(uint32_t) * n);
+	for (i=0;i<n;i++) keys[i] = random();
+	return keys;
+}
+
+/* Builds maps of size keys from scratch like the ones of the analysis,
+   an operation is an insert. */
+static void
+bench_map_set(uint32_t size, uint64_t ops)
+{
+	struct map * map;
+	uint32_t * keys, i;
+	uint64_t op;
+
+	keys = random_keys(size);
+
+	timer_start();
+	map = map_new(MAP_HASHSIZE);
+	for (op=0,i=0;op<ops;op++) {
+		if (map_set(map, keys[i], (void *)(uintptr_t)i) < 0)
+			fatal("Out of memory.");
+		if (++i == size) {
+			sink += map_count(map);
+			map_free(map, NULL);
+			map = map_new(MAP_HASHSIZE);
+			i = 0;
+		}
+	}
+	map_free(map, NULL);
+	timer_stop();
+
+	free(keys);
+}
+
+/* Looks up the keys of a map with size keys in random order, an
+   operation is a lookup. */
+static void
+bench_map_get(uint32_t size, uint64_t ops)
+{
+	struct map * map;
+	uint32_t * keys, * order, i;
+	uint64_t op;
+
+	keys = random_keys(size);
+	order = random_keys(size);
+	map = map_new(MAP_HASHSIZE);
+	for (i=0;i<size;i++) {
+		if (map_set(map, keys[i], (void *)(uintptr_t)(i + 1)) < 0)
+			fatal("Out of memory.");
+		order[i] = keys[order[i] % size];
+	}
+
+	timer_start();
+	for (op=0,i=0;op<ops;op++) {
+		sink += (uintptr_t)map_get(map, order[i]);
+		if (++i == size) i = 0;
+	}
+	timer_stop();
+
+	map_free(map, NULL);
+	free(keys);
+	free(order);
+}
+
+/* Gets the sorted keys of a map with size keys, an operation is a
+   call. */
+static void
+bench_map_getkeys(uint32_t size, uint64_t ops)
+{
+	struct list * list;
+	struct map * map;
+	uint32_t * keys, i;
+	uint64_t op;
+
+	keys = random_keys(size);
+	map = map_new(MAP_HASHSIZE);
+	for (i=0;i<size;i++) {
+		if (map_set(map, keys[i], NULL) < 0) fatal("Out of memory.");
+	}
+
+	timer_start();
+	for (op=0;op<ops;op++) {
+		list = map_getkeys(map, 1);
+		if (!list) fatal("Out of memory.");
+		sink += list_count(list);
+		list_free(list);
+	}
+	timer_stop();
+
+	map_free(map, NULL);
+	free(keys);
+}
+
+/* Builds lists of size http entries from scratch, an operation is an
+   append. */
+static void
+bench_list_append(uint32_t size, uint64_t ops)
+{
+	struct http_entry hte;
+	struct list * list;
+	uint64_t op;
+	uint32_t i;
+
+	memset(&hte, 0, sizeof(struct http_entry));
+
+	timer_start();
+	list = list_new(sizeof(struct http_entry));
+	for (op=0,i=0;op<ops;op++) {
+		hte.reslen = i;
+		if (list_append(list, &hte) < 0) fatal("Out of memory.");
+		if (++i == size) {
+			sink += list_count(list);
+			list_free(list);
+			list = list_new(sizeof(struct http_entry));
+			i = 0;
+		}
+	}
+	list_free(list);
+	timer_stop();
+}
+
+static struct list *
+random_list(uint32_t size)
+{
+	struct list * list;
+	uint32_t i, v;
+
+	list = list_new(sizeof(uint32_t));
+	for (i=0;i<size;i++) {
+		v = random();
+		if (list_append(list, &v) < 0) fatal("Out of memory.");
+	}
+	return list;
+}
+
+/* Gets the entries of a list of size entries in random order, an
+   operation is a get. */
+static void
+bench_list_get(uint32_t size, uint64_t ops)
+{
+	struct list * list;
+	uint32_t * order, i, v;
+	uint64_t op;
+
+	list = random_list(size);
+	order = random_keys(size);
+	for (i=0;i<size;i++) order[i] %= size;
+
+	timer_start();
+	for (op=0,i=0;op<ops;op++) {
+		if (list_get(list, order[i], &v) < 0)
+			fatal("Unexpected error in list_get");
+		sink += v;
+		if (++i == size) i = 0;
+	}
+	timer_stop();
+
+	list_free(list);
+	free(order);
+}
+
+/* Looks for entries of a list of size entries, half of them aren't in
+   the list. An operation is a search. */
+static void
+bench_list_contains(uint32_t size, uint64_t ops)
+{
+	struct list * list;
+	uint32_t * values, i;
+	uint64_t op;
+
+	list = random_list(size);
+	values = random_keys(size);
+	for (i=0;i<size;i+=2) list_get(list, values[i] % size, &values[i]);
+
+	timer_start();
+	for (op=0,i=0;op<ops;op++) {
+		sink += list_contains(list, &values[i]);
+		if (++i == size) i = 0;
+	}
+	timer_stop();
+
+	list_free(list);
+	free(values);
+}
+
+static struct bench benches[] = {
+	{ "ssl_parse", { 64, 1448, 16384 }, bench_ssl_parse },
+	{ "ssl_scan", { 64, 1448, 16384 }, bench_ssl_scan },
+	{ "mkhash", { 1024, 65536 }, bench_mkhash },
+	{ "lpm_lookup", { 16, 1024, 16384 }, bench_lpm_lookup },
+	{ "buffer_append", { 64, 1448, 16384 }, bench_buffer_append },
+	{ "map_set", { 100, 10000, 100000 }, bench_map_set },
+	{ "map_get", { 100, 10000, 100000 }, bench_map_get },
+	{ "map_getkeys", { 100, 10000, 100000 }, bench_map_getkeys },
+	{ "list_append", { 16, 1024, 65536 }, bench_list_append },
+	{ "list_get", { 16, 1024, 65536 }, bench_list_get },
+	{ "list_contains", { 16, 1024, 65536 }, bench_list_contains },
+};
+
+/* Finds the number of operations for a round of MIN_ROUND_NS, then
+   keeps the best of ROUNDS rounds. */
+static void
+run_bench(struct bench * b, uint32_t size, struct result * r)
+{
+	uint64_t ops;
+	uint32_t i;
+
+	ops = 1;
+	while (1) {
+		srandom(SEED);
+		b->run(size, ops);
+		if (t_ns >= MIN_ROUND_NS / 4 || ops >= (1ULL << 40)) break;
+		ops *= (t_ns < MIN_ROUND_NS / 400 ? 16 : 2);
+	}
+	ops = (ops * MIN_ROUND_NS) / (t_ns ? t_ns : 1) + 1;
+
+	snprintf(r->name, MAX_NAME, "%s/%u", b->name, size);
+	r->ops = ops;
+	r->ns = -1;
+	for (i=0;i<ROUNDS;i++) {
+		srandom(SEED);
+		b->run(size, ops);
+		if (r->ns < 0 || (double)t_ns / ops < r->ns) {
+			r->ns = (double)t_ns / ops;
+			r->cycles = (double)c_cycles / ops;
+			r->allocs = (double)allocs / ops;
+		}
+	}
+}
+
+static void
+save_results(const char * fn)
+{
+	struct result * r;
+	uint32_t i;
+	FILE * fp;
+
+	fp = fopen(fn, "w");
+	if (!fp) fatal("Cannot write the results.");
+
+	fprintf(fp, "{\n  \"benchmarks\": [\n");
+	for (i=0;i<nr_results;i++) {
+		r = &(results[i]);
+		fprintf(fp, "    {\"name\": \"%s\", \"ops\": %llu, "
+			"\"ns_per_op\": %.3f, \"allocs_per_op\": %.4f, "
+			"\"cycles_per_op\": %.1f}%s\n", r->name,
+			(unsigned long long)r->ops, r->ns, r->allocs,
+			r->cycles, (i + 1 < nr_results ? "," : ""));
+	}
+	fprintf(fp, "  ]\n}\n");
+
+	fclose(fp);
+}
+
+/* Reads a file written by save_results(), returns the number of
+   results. */
+static uint32_t
+load_results(const char * fn, struct result * base)
+{
+	unsigned long long ops;
+	char line[512];
+	uint32_t n = 0;
+	FILE * fp;
+
+	fp = fopen(fn, "r");
+	if (!fp) fatal("Cannot open the baseline.");
+
+	while (n < MAX_RESULTS && fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, " {\"name\": \"%63[^\"]\", \"ops\": %llu, "
+				"\"ns_per_op\": %lf, \"allocs_per_op\": %lf, "
+				"\"cycles_per_op\": %lf}", base[n].name, &ops,
+				&(base[n].ns), &(base[n].allocs),
+				&(base[n].cycles)) != 5)
+			continue;
+		base[n].ops = ops;
+		n++;
+	}
+
+	fclose(fp);
+	return n;
+}
+
+static void
+usage(const char * arg0)
+{
+	fprintf(stderr, "%s [options]\n", arg0);
+	fprintf(stderr, "Run the microbenchmarks.\n\n");
+	fprintf(stderr, "-o <json>      - save the results to this file\n");
+	fprintf(stderr, "-c <json>      - compare with the results in this");
+	fprintf(stderr, " file\n");
+	fprintf(stderr, "-t <percent>   - slowdown flagged as a regression");
+	fprintf(stderr, " (default: %.0f)\n", REGRESSION_THRESHOLD);
+	fprintf(stderr, "-f <name>      - only run the benchmarks with this");
+	fprintf(stderr, " in their name\n");
+	fprintf(stderr, "-C <flows>     - count the flow hash collisions of");
+	fprintf(stderr, " this many flows instead\n");
+	fprintf(stderr, "-T <MB>        - measure the throughput of the SSL");
+	fprintf(stderr, " record scanner instead\n");
+	fprintf(stderr, "-h             - usage information\n");
+}
+
+int
+main(int argc, char ** argv, char ** envp)
+{
+	static struct result base[MAX_RESULTS];
+	const char * outfn = NULL, * basefn = NULL, * filter = NULL;
+	double threshold = REGRESSION_THRESHOLD, diff;
+	uint32_t i, j, k, nr_base = 0, regressions = 0, nr_flows = 0, mb = 0;
+	char name[MAX_NAME];
+	struct result * r;
+	int c;
+
+	while ((c = getopt(argc, argv, "ho:c:t:f:C:T:")) != -1) {
+		switch (c) {
+			case 'o':
+				outfn = optarg;
+				break;
+			case 'c':
+				basefn = optarg;
+				break;
+			case 't':
+				threshold = strtod(optarg, NULL);
+				break;
+			case 'f':
+				filter = optarg;
+				break;
+			case 'C':
+				nr_flows = strtoul(optarg, NULL, 10);
+				if (nr_flows < 2) fatal("Invalid number of flows.");
+				break;
+			case 'T':
+				mb = strtoul(optarg, NULL, 10);
+				if (!mb || mb > 4096) fatal("Invalid size.");
+				break;
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (basefn) nr_base = load_results(basefn, base);
+
+	init_hash();
+
+	if (nr_flows) {
+		hash_collisions(nr_flows);
+		return 0;
+	}
+	if (mb) {
+		ssl_throughput(mb);
+		return 0;
+	}
+
+	printf("%-22s %12s %10s %10s %10s%s\n", "benchmark", "ops", "ns/op",
+		"cycles/op", "allocs/op", (basefn ? "    vs base" : ""));
+	for (i=0;i<sizeof(benches)/sizeof(struct bench);i++) {
+		for (j=0;j<4 && benches[i].sizes[j];j++) {
+			snprintf(name, sizeof(name), "%s/%u", benches[i].name,
+				benches[i].sizes[j]);
+			if (filter && !strstr(name, filter)) continue;
+			if (nr_results == MAX_RESULTS) break;
+
+			r = &(results[nr_results++]);
+			run_bench(&(benches[i]), benches[i].sizes[j], r);
+			printf("%-22s %12llu %10.2f %10.1f %10.4f", r->name,
+				(unsigned long long)r->ops, r->ns, r->cycles,
+				r->allocs);
+
+			for (k=0;k<nr_base;k++) {
+				if (!strcmp(base[k].name, r->name)) break;
+			}
+			if (k < nr_base) {
+				diff = (r->ns / base[k].ns - 1.0) * 100.0;
+				printf(" %+9.1f%%", diff);
+				if (diff > threshold ||
+						r->allocs > base[k].allocs +
+						0.0001) {
+					printf("  REGRESSION");
+					regressions++;
+				}
+			}
+			else if (basefn) printf(" %10s", "new");
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+
+	if (outfn) save_results(outfn);
+
+	if (basefn) {
+		printf("%u regression%s against %s\n", regressions,
+			(regressions == 1 ? "" : "s"), basefn);
+	}
+	return (regressions ? EXIT_FAILURE : 0);
+}
+
+/* EOF */
@@ -0,0 +1,257 @@
+/* bitmap.c */
+
+/* Sparse two dimensional bitmap of (x, y) tile coordinates. Every x
+   value with at least one bit set gets a column container which holds
+   only the non-zero 64 bit words of that column as a sorted array of
+   (y / 64, word) pairs, so memory use is bounded by the number of set
+   bits and runs of y values can be inspected a word at a time. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+#include "map.h"
+#include "list.h"
+
+struct bitmap_column {
+	uint32_t count;
+	uint32_t alloc;
+	uint32_t * keys;
+	uint64_t * words;
+};
+
+struct bitmap {
+	struct map * columns;
+	uint32_t count;
+};
+
+#define WORD_BITS	64
+#define WORD_KEY(y)	((y) / WORD_BITS)
+#define WORD_BIT(y)	((uint64_t)1 << ((y) % WORD_BITS))
+
+/* all bits from bit position lo up to and including hi */
+#define WORD_MASK(lo, hi) \
+	((~(uint64_t)0 >> (WORD_BITS - 1 - (hi))) & (~(uint64_t)0 << (lo)))
+
+struct bitmap *
+bitmap_new()
+{
+	struct bitmap * b;
+
+	b = malloc(sizeof(struct bitmap));
+	if (!b) return NULL;
+
+	b->columns = map_new(1009);
+	if (!b->columns) {
+		free(b);
+		return NULL;
+	}
+	b->count = 0;
+
+	return b;
+}
+
+/* Returns the index of the first word in the column with a key bigger
+   than or equal to key. */
+static uint32_t
+column_find(struct bitmap_column * col, uint32_t key)
+{
+	uint32_t lo, hi, mid;
+
+	lo = 0;
+	hi = col->count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (col->keys[mid] < key) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static uint64_t
+column_word(struct bitmap_column * col, uint32_t key)
+{
+	uint32_t i;
+
+	i = column_find(col, key);
+	if (i < col->count && col->keys[i] == key)
+		return col->words[i];
+	return 0;
+}
+
+int
+bitmap_set(struct bitmap * b, uint32_t x, uint32_t y)
+{
+	struct bitmap_column * col;
+	uint32_t * keys;
+	uint64_t * words;
+	uint32_t i, key;
+
+	if (!b) return -1;
+
+	col = map_get(b->columns, x);
+	if (!col) {
+		col = malloc(sizeof(struct bitmap_column));
+		if (!col) return -1;
+		memset(col, 0, sizeof(struct bitmap_column));
+		if (map_set(b->columns, x, col) < 0) {
+			free(col);
+			return -1;
+		}
+	}
+
+	key = WORD_KEY(y);
+	i = column_find(col, key);
+	if (i == col->count || col->keys[i] != key) {
+		if (col->count == col->alloc) {
+			col->alloc = (col->alloc ? col->alloc * 2 : 4);
+			keys = realloc(col->keys, sizeof(uint32_t) * col->alloc);
+			if (!keys) return -1;
+			col->keys = keys;
+			words = realloc(col->words,
+				sizeof(uint64_t) * col->alloc);
+			if (!words) return -1;
+			col->words = words;
+		}
+		memmove(col->keys + i + 1, col->keys + i,
+			sizeof(uint32_t) * (col->count - i));
+		memmove(col->words + i + 1, col->words + i,
+			sizeof(uint64_t) * (col->count - i));
+		col->keys[i] = key;
+		col->words[i] = 0;
+		col->count++;
+	}
+
+	if (!(col->words[i] & WORD_BIT(y))) {
+		col->words[i] |= WORD_BIT(y);
+		b->count++;
+	}
+
+	return 0;
+}
+
+int
+bitmap_test(struct bitmap * b, uint32_t x, uint32_t y)
+{
+	struct bitmap_column * col;
+
+	if (!b) return 0;
+
+	col = map_get(b->columns, x);
+	if (!col) return 0;
+
+	return (column_word(col, WORD_KEY(y)) & WORD_BIT(y)) != 0;
+}
+
+/* Returns 1 if all bits from (x, y0) up to and including (x, y1) are
+   set. */
+int
+bitmap_test_range(struct bitmap * b, uint32_t x, uint32_t y0, uint32_t y1)
+{
+	struct bitmap_column * col;
+	uint32_t i, key, lo, hi;
+	uint64_t mask;
+
+	if (!b || y0 > y1) return 0;
+
+	col = map_get(b->columns, x);
+	if (!col) return 0;
+
+	/* the words of the range need to be present and consecutive */
+	i = column_find(col, WORD_KEY(y0));
+	for (key=WORD_KEY(y0);key<=WORD_KEY(y1);key++,i++) {
+		if (i >= col->count || col->keys[i] != key)
+			return 0;
+		lo = (key == WORD_KEY(y0) ? y0 % WORD_BITS : 0);
+		hi = (key == WORD_KEY(y1) ? y1 % WORD_BITS : WORD_BITS - 1);
+		mask = WORD_MASK(lo, hi);
+		if ((col->words[i] & mask) != mask)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Finds the first run of set bits in column x which starts at or after
+   y. Returns 0 and the first and last y value of the run, or -1 if there
+   are no more bits set. */
+int
+bitmap_next_run(struct bitmap * b, uint32_t x, uint32_t y,
+	uint32_t * first, uint32_t * last)
+{
+	struct bitmap_column * col;
+	uint32_t i, bit, n;
+	uint64_t w;
+
+	if (!b || !first || !last) return -1;
+
+	col = map_get(b->columns, x);
+	if (!col) return -1;
+
+	/* find the start of the run */
+	i = column_find(col, WORD_KEY(y));
+	if (i == col->count) return -1;
+	w = col->words[i];
+	if (col->keys[i] == WORD_KEY(y))
+		w &= ~(uint64_t)0 << (y % WORD_BITS);
+	while (!w) {
+		if (++i == col->count) return -1;
+		w = col->words[i];
+	}
+	bit = __builtin_ctzll(w);
+	*first = col->keys[i] * WORD_BITS + bit;
+
+	/* find its end, possibly crossing into the following words */
+	while (1) {
+		w = ~(col->words[i] >> bit);
+		n = (w ? __builtin_ctzll(w) : WORD_BITS);
+		if (bit + n < WORD_BITS) {
+			*last = col->keys[i] * WORD_BITS + bit + n - 1;
+			return 0;
+		}
+		if (i + 1 == col->count ||
+				col->keys[i + 1] != col->keys[i] + 1 ||
+				!(col->words[i + 1] & 1)) {
+			*last = col->keys[i] * WORD_BITS + WORD_BITS - 1;
+			return 0;
+		}
+		i++;
+		bit = 0;
+	}
+}
+
+uint32_t
+bitmap_count(struct bitmap * b)
+{
+	if (!b) return 0;
+	return b->count;
+}
+
+/* Returns the sorted list of x values with at least one bit set. */
+struct list *
+bitmap_getcolumns(struct bitmap * b)
+{
+	if (!b) return NULL;
+	return map_getkeys(b->columns, 1);
+}
+
+static void
+column_free(void * p)
+{
+	struct bitmap_column * col = p;
+
+	free(col->keys);
+	free(col->words);
+	free(col);
+}
+
+void
+bitmap_free(struct bitmap * b)
+{
+	if (!b) return;
+
+	map_free(b->columns, column_free);
+	free(b);
+}
+
+/* EOF */
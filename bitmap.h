@@ -0,0 +1,21 @@
+/* bitmap.h */
+
+#ifndef BITMAP_H
+  #define BITMAP_H
+
+#include <stdint.h>
+#include "list.h"
+
+struct bitmap * bitmap_new();
+int bitmap_set(struct bitmap *, uint32_t, uint32_t);
+int bitmap_test(struct bitmap *, uint32_t, uint32_t);
+int bitmap_test_range(struct bitmap *, uint32_t, uint32_t, uint32_t);
+int bitmap_next_run(struct bitmap *, uint32_t, uint32_t,
+	uint32_t *, uint32_t *);
+uint32_t bitmap_count(struct bitmap *);
+struct list * bitmap_getcolumns(struct bitmap *);
+void bitmap_free(struct bitmap *);
+
+#endif
+
+/* EOF */
@@ -0,0 +1,466 @@
+/* burstlog.c */
+
+/* Recording and replay of the bursts libtrafficker emits. A burst log
+   starts with a magic and a version, followed by the bursts in the
+   order they were emitted. Every burst is stored as a flags byte, the
+   zigzag varint delta to the timestamp of the previous burst, the flow
+   it belongs to and its varint length. The addresses, ports and hash of
+   a flow are only stored with its first burst, later ones refer to it
+   by its varint flow number. Bursts with the RECORDS flag are followed
+   by the varint number of their SSL records and the varint lengths of
+   as many of them as a burst holds, logs of version 1 don't have them.
+   Timestamps are in microseconds, logs before version 3 have seconds
+   which are converted when they are read.
+
+   The log is cut into blocks of about BURSTLOG_BLOCK_SIZE bytes which
+   don't depend on earlier blocks: the first burst of a block has the
+   BLOCK flag set, its timestamp delta is the absolute time and flow
+   numbers start over. The time index at the end of the log holds the
+   first timestamp and offset of every block, followed by the trailer
+
+	uint32 number of index entries
+	uint64 offset of the index
+	uint32 magic
+
+   A log without index, e.g. of a recording that got killed, can still
+   be replayed from the start. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "burstlog.h"
+#include "gmaps.h"
+
+#define BURSTLOG_HDR_LEN	5
+#define BURSTLOG_TRAILER_LEN	16
+
+/* flags of a burst */
+#define FLAG_CLIENT		0x01
+#define FLAG_INCOMPLETE		0x02
+#define FLAG_NEW_FLOW		0x04
+#define FLAG_BLOCK		0x08
+#define FLAG_RECORDS		0x10
+
+struct burstlog_index {
+	int64_t ts;
+	uint64_t off;
+};
+
+struct burstlog {
+	FILE * f;
+	int writing;
+	uint64_t off;
+	uint64_t block_off;
+	int64_t last_ts;
+
+	/* flows of the current block, when writing they are looked up by
+	   their hash */
+	struct burst * flows;
+	uint32_t nr_flows;
+	uint32_t flows_alloc;
+	struct map * flowmap;
+
+	struct burstlog_index * index;
+	uint32_t nr_index;
+	uint32_t index_alloc;
+
+	/* replay */
+	uint64_t data_end;
+	uint32_t next_block;
+	uint64_t ts_scale;
+	int ranged;
+	int64_t from;
+	int64_t to;
+};
+
+static size_t
+varint_put64(unsigned char * p, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+static inline uint64_t
+zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t
+unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int
+flows_add(struct burstlog * l, const struct burst * b)
+{
+	struct burst * flows;
+
+	if (l->nr_flows == l->flows_alloc) {
+		l->flows_alloc = (l->flows_alloc ? l->flows_alloc * 2 : 256);
+		flows = realloc(l->flows, sizeof(struct burst) * l->flows_alloc);
+		if (!flows) return -1;
+		l->flows = flows;
+	}
+	memcpy(&(l->flows[l->nr_flows++]), b, sizeof(struct burst));
+	return 0;
+}
+
+struct burstlog *
+burstlog_create(const char * fname)
+{
+	struct burstlog * l;
+
+	if (!fname) return NULL;
+
+	l = malloc(sizeof(struct burstlog));
+	if (!l) return NULL;
+	memset(l, 0, sizeof(struct burstlog));
+
+	l->f = fopen(fname, "wb");
+	if (!l->f) {
+		free(l);
+		return NULL;
+	}
+	l->writing = 1;
+
+	write_uint32(l->f, BURSTLOG_MAGIC);
+	write_uint8(l->f, BURSTLOG_VERSION);
+	l->off = BURSTLOG_HDR_LEN;
+
+	return l;
+}
+
+static int
+new_block(struct burstlog * l, int64_t ts)
+{
+	struct burstlog_index * index;
+
+	if (l->nr_index == l->index_alloc) {
+		l->index_alloc = (l->index_alloc ? l->index_alloc * 2 : 64);
+		index = realloc(l->index,
+			sizeof(struct burstlog_index) * l->index_alloc);
+		if (!index) return -1;
+		l->index = index;
+	}
+	l->index[l->nr_index].ts = ts;
+	l->index[l->nr_index].off = l->off;
+	l->nr_index++;
+
+	if (l->flowmap) map_free(l->flowmap, NULL);
+	l->flowmap = map_new(SESSIONMAP_HASHSIZE);
+	if (!l->flowmap) return -1;
+
+	l->block_off = l->off;
+	l->last_ts = 0;
+	l->nr_flows = 0;
+
+	return 0;
+}
+
+int
+burstlog_write(struct burstlog * l, const struct burst * b)
+{
+	unsigned char buf[128];
+	struct burst * flow;
+	uintptr_t nr;
+	uint8_t flags = 0;
+	uint32_t i;
+	size_t n;
+
+	if (!l || !l->writing || !b) return -1;
+
+	if (!l->nr_index || l->off - l->block_off >= BURSTLOG_BLOCK_SIZE) {
+		if (new_block(l, b->ts) < 0) return -1;
+		flags |= FLAG_BLOCK;
+	}
+
+	nr = (uintptr_t)map_get(l->flowmap, (uint32_t)b->hash);
+	flow = (nr ? &(l->flows[nr - 1]) : NULL);
+	if (!flow || flow->chost != b->chost || flow->dhost != b->dhost ||
+			flow->cport != b->cport || flow->dport != b->dport) {
+		if (flows_add(l, b) < 0) return -1;
+		nr = l->nr_flows;
+		if (map_set(l->flowmap, (uint32_t)b->hash, (void *)nr) < 0)
+			return -1;
+		flags |= FLAG_NEW_FLOW;
+	}
+	if (b->client) flags |= FLAG_CLIENT;
+	if (b->incomplete) flags |= FLAG_INCOMPLETE;
+	if (b->nr_records) flags |= FLAG_RECORDS;
+
+	n = 0;
+	buf[n++] = flags;
+	n += varint_put64(buf + n, zigzag((int64_t)b->ts - l->last_ts));
+	if (flags & FLAG_NEW_FLOW) {
+		n += varint_put64(buf + n, b->hash);
+		n += varint_put64(buf + n, b->chost);
+		n += varint_put64(buf + n, b->cport);
+		n += varint_put64(buf + n, b->dhost);
+		n += varint_put64(buf + n, b->dport);
+	}
+	else n += varint_put64(buf + n, nr - 1);
+	n += varint_put64(buf + n, b->len);
+	if (flags & FLAG_RECORDS) {
+		n += varint_put64(buf + n, b->nr_records);
+		for (i=0;i<b->nr_records && i<BURST_MAX_RECORDS;i++)
+			n += varint_put64(buf + n, b->records[i]);
+	}
+
+	write_data(l->f, buf, n);
+	l->off += n;
+	l->last_ts = b->ts;
+
+	return 0;
+}
+
+static int
+read_trailer(struct burstlog * l, uint64_t size)
+{
+	unsigned char buf[BURSTLOG_TRAILER_LEN];
+	uint64_t index_off;
+	uint32_t count, magic, i;
+
+	if (size < BURSTLOG_HDR_LEN + BURSTLOG_TRAILER_LEN) return -1;
+	if (fseek(l->f, size - BURSTLOG_TRAILER_LEN, SEEK_SET) < 0) return -1;
+	if (fread(buf, sizeof(buf), 1, l->f) != 1) return -1;
+
+	count = ((uint32_t)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) |
+		buf[3];
+	index_off = 0;
+	for (i=4;i<12;i++) index_off = (index_off << 8) | buf[i];
+	magic = ((uint32_t)buf[12] << 24) | (buf[13] << 16) | (buf[14] << 8) |
+		buf[15];
+	if (magic != BURSTLOG_MAGIC || index_off < BURSTLOG_HDR_LEN ||
+			index_off > size - BURSTLOG_TRAILER_LEN ||
+			(size - BURSTLOG_TRAILER_LEN - index_off) / 16 != count)
+		return -1;
+
+	if (fseek(l->f, index_off, SEEK_SET) < 0) return -1;
+	l->index = malloc(sizeof(struct burstlog_index) * (count + 1));
+	if (!l->index) return -1;
+	for (i=0;i<count;i++) {
+		l->index[i].ts = ((uint64_t)read_uint32(l->f) << 32);
+		l->index[i].ts |= read_uint32(l->f);
+		l->index[i].ts *= l->ts_scale;
+		l->index[i].off = ((uint64_t)read_uint32(l->f) << 32);
+		l->index[i].off |= read_uint32(l->f);
+	}
+	l->nr_index = count;
+	l->data_end = index_off;
+
+	return 0;
+}
+
+struct burstlog *
+burstlog_open(const char * fname)
+{
+	struct burstlog * l;
+	unsigned char buf[BURSTLOG_HDR_LEN];
+	uint32_t magic;
+	long size;
+
+	if (!fname) return NULL;
+
+	l = malloc(sizeof(struct burstlog));
+	if (!l) return NULL;
+	memset(l, 0, sizeof(struct burstlog));
+
+	l->f = fopen(fname, "rb");
+	if (!l->f) {
+		free(l);
+		return NULL;
+	}
+
+	magic = 0;
+	if (fread(buf, sizeof(buf), 1, l->f) == 1)
+		magic = ((uint32_t)buf[0] << 24) | (buf[1] << 16) |
+			(buf[2] << 8) | buf[3];
+	if (magic != BURSTLOG_MAGIC || buf[4] < 1 ||
+			buf[4] > BURSTLOG_VERSION ||
+			fseek(l->f, 0, SEEK_END) < 0 ||
+			(size = ftell(l->f)) < 0) {
+		burstlog_close(l);
+		return NULL;
+	}
+	l->ts_scale = (buf[4] < 3 ? 1000000 : 1);
+
+	/* without the index the log is only read from the start */
+	if (read_trailer(l, size) < 0) {
+		free(l->index);
+		l->index = NULL;
+		l->nr_index = 0;
+		l->data_end = size;
+	}
+
+	if (fseek(l->f, BURSTLOG_HDR_LEN, SEEK_SET) < 0) {
+		burstlog_close(l);
+		return NULL;
+	}
+	l->off = BURSTLOG_HDR_LEN;
+
+	return l;
+}
+
+/* Only replays the bursts from second from up to and including second
+   to. With a time index the replay starts at the last block that starts
+   before from and stops at the first block that starts after to. */
+int
+burstlog_set_range(struct burstlog * l, time_t from, time_t to)
+{
+	uint32_t i, start;
+
+	if (!l || l->writing || from > to) return -1;
+
+	/* an open end of the range stays open */
+	l->ranged = 1;
+	l->from = (from < INT64_MAX / 1000000 ? (int64_t)from * 1000000 :
+		INT64_MAX);
+	l->to = (to < INT64_MAX / 1000000 - 1 ?
+		(int64_t)to * 1000000 + 999999 : INT64_MAX);
+
+	start = 0;
+	for (i=0;i<l->nr_index;i++) {
+		if (l->index[i].ts <= l->from) start = i;
+	}
+	if (l->nr_index) {
+		if (fseek(l->f, l->index[start].off, SEEK_SET) < 0) return -1;
+		l->off = l->index[start].off;
+		l->next_block = start;
+	}
+
+	return 0;
+}
+
+static inline int
+varint_read(struct burstlog * l, uint64_t * v)
+{
+	uint64_t r = 0;
+	int c, shift;
+
+	for (shift=0;shift<64;shift+=7) {
+		c = getc_unlocked(l->f);
+		if (c == EOF) return -1;
+		l->off++;
+		r |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*v = r;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Gets the next burst. Returns 1 if there was one, 0 at the end of the
+   log and -1 if the log is corrupt. */
+int
+burstlog_read(struct burstlog * l, struct burst * b)
+{
+	uint64_t v, ts, hash, chost, cport, dhost, dport, len;
+	uint32_t i;
+	int flags;
+
+	if (!l || l->writing || !b) return -1;
+
+	while (1) {
+		if (l->off >= l->data_end) return 0;
+		if (l->next_block < l->nr_index &&
+				l->off == l->index[l->next_block].off) {
+			if (l->ranged && l->index[l->next_block].ts > l->to)
+				return 0;
+			l->next_block++;
+		}
+
+		flags = getc_unlocked(l->f);
+		if (flags == EOF) return 0;
+		l->off++;
+		if (flags & FLAG_BLOCK) {
+			l->last_ts = 0;
+			l->nr_flows = 0;
+		}
+
+		if (varint_read(l, &ts) < 0) return 0;
+		memset(b, 0, sizeof(struct burst));
+		l->last_ts += unzigzag(ts);
+		b->ts = l->last_ts * l->ts_scale;
+
+		if (flags & FLAG_NEW_FLOW) {
+			if (varint_read(l, &hash) < 0 ||
+					varint_read(l, &chost) < 0 ||
+					varint_read(l, &cport) < 0 ||
+					varint_read(l, &dhost) < 0 ||
+					varint_read(l, &dport) < 0)
+				return 0;
+			b->hash = hash;
+			b->chost = chost;
+			b->cport = cport;
+			b->dhost = dhost;
+			b->dport = dport;
+			if (flows_add(l, b) < 0) return -1;
+		}
+		else {
+			if (varint_read(l, &v) < 0) return 0;
+			if (v >= l->nr_flows) return -1;
+			b->hash = l->flows[v].hash;
+			b->chost = l->flows[v].chost;
+			b->cport = l->flows[v].cport;
+			b->dhost = l->flows[v].dhost;
+			b->dport = l->flows[v].dport;
+		}
+
+		if (varint_read(l, &len) < 0) return 0;
+		b->len = len;
+		if (flags & FLAG_RECORDS) {
+			if (varint_read(l, &v) < 0) return 0;
+			b->nr_records = v;
+			for (i=0;i<b->nr_records && i<BURST_MAX_RECORDS;i++) {
+				if (varint_read(l, &v) < 0) return 0;
+				b->records[i] = v;
+			}
+		}
+		b->client = (flags & FLAG_CLIENT) != 0;
+		b->incomplete = (flags & FLAG_INCOMPLETE) != 0;
+
+		if (!l->ranged || ((int64_t)b->ts >= l->from &&
+				(int64_t)b->ts <= l->to))
+			return 1;
+	}
+}
+
+/* Closes the log, a log being written gets its time index. */
+void
+burstlog_close(struct burstlog * l)
+{
+	uint32_t i;
+
+	if (!l) return;
+
+	if (l->writing) {
+		for (i=0;i<l->nr_index;i++) {
+			write_uint32(l->f, (uint64_t)l->index[i].ts >> 32);
+			write_uint32(l->f, l->index[i].ts & 0xffffffff);
+			write_uint32(l->f, l->index[i].off >> 32);
+			write_uint32(l->f, l->index[i].off & 0xffffffff);
+		}
+		write_uint32(l->f, l->nr_index);
+		write_uint32(l->f, l->off >> 32);
+		write_uint32(l->f, l->off & 0xffffffff);
+		write_uint32(l->f, BURSTLOG_MAGIC);
+	}
+
+	fclose(l->f);
+	if (l->flowmap) map_free(l->flowmap, NULL);
+	free(l->flows);
+	free(l->index);
+	free(l);
+}
+
+/* EOF */
@@ -0,0 +1,29 @@
+/* burstlog.h */
+
+#ifndef BURSTLOG_H
+  #define BURSTLOG_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "libtrafficker.h"
+
+#define BURSTLOG_MAGIC			0x474d424c
+#define BURSTLOG_VERSION		3
+
+/* a new block starts after this many bytes, blocks are the unit of the
+   time index */
+#define BURSTLOG_BLOCK_SIZE		(256 * 1024)
+
+struct burstlog;
+
+struct burstlog * burstlog_create(const char *);
+int burstlog_write(struct burstlog *, const struct burst *);
+struct burstlog * burstlog_open(const char *);
+int burstlog_set_range(struct burstlog *, time_t, time_t);
+int burstlog_read(struct burstlog *, struct burst *);
+void burstlog_close(struct burstlog *);
+
+#endif
+
+/* EOF */
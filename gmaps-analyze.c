@@ -0,0 +1,339 @@
+/* gmaps-analyze.c */
+
+/* The analysis of a window of HTTP req/res pairs: the tiles of the
+   profile matching the response sizes become candidates, adjacent
+   candidates form retangles and the retangles get clustered into the
+   location the user is looking at. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gmaps.h"
+#include "gmaps-analyze.h"
+
+struct zoom_stats zstats[MAX_Z];
+
+struct matches *
+matches_new()
+{
+	/* the per zoom bitmaps are only created once a candidate for that
+	   zoom level shows up, see matches_add() */
+	return xmalloc(sizeof(struct matches));
+}
+
+void
+matches_free(struct matches * m)
+{
+	uint32_t i;
+
+	for(i=0;i<MAX_Z;i++) {
+		if (m->tiles[i]) bitmap_free(m->tiles[i]);
+	}
+	free(m);
+}
+
+/* Adds the candidates for one HTTP response to the matches of all
+   nr_regions regions with a single scan over the profile, matches is
+   indexed by region id. Only zoom levels in the zmask bitmask are
+   considered. */
+void
+matches_add(struct profile * profile, uint32_t nr_regions,
+	struct matches ** matches, const struct http_entry * hte,
+	uint32_t zmask)
+{
+	struct matches * m;
+	struct bitmap * tiles;
+	struct list * pflist;
+	struct profile_entry pe;
+	uint32_t i, j, c;
+	size_t reslen, minreslen, maxreslen;	
+
+	reslen = hte->reslen;
+	if (reslen < MIN_TILE_LEN || reslen > MAX_TILE_LEN) {
+		verbose(3, "Ignoring entry because not in tile range!: %lu\n",
+			reslen);
+		return;
+	}
+
+	/* establish the lower and upper bounds for the match search */
+	minreslen = reslen - TILE_LEN_RANGE;
+	if (minreslen < MIN_TILE_LEN || minreslen > reslen)
+		minreslen = MIN_TILE_LEN;
+	maxreslen = reslen + TILE_LEN_RANGE;
+	if (maxreslen > MAX_TILE_LEN || maxreslen < reslen)
+		maxreslen = MAX_TILE_LEN;
+
+	/* build the list of all matches for the input HTTP request */
+	for (i=minreslen;i<=maxreslen;i++) {
+
+		pflist = profile_get(profile, i);
+		if (!pflist) continue;
+
+		c = list_count(pflist);
+		for (j=0;j<c;j++) {
+			if (list_get(pflist, j, &pe) < 0) {
+				fatal("Unexpected error in list_get");
+			}
+
+			/* quick sanity check */
+			if (pe.z < 0 || pe.z >= MAX_Z ||
+				pe.x < 0 || pe.x >= MAX_X ||
+				pe.y < 0 || pe.y >= MAX_Y ||
+				pe.id >= nr_regions)
+				continue;
+			if (!(zmask & (1 << pe.z)))
+				continue;
+			zstats[pe.z].candidates++;
+
+			m = matches[pe.id];
+			tiles = m->tiles[pe.z];
+			if (!tiles) {
+				tiles = bitmap_new();
+				if (!tiles) fatal("Out of memory.");
+				m->tiles[pe.z] = tiles;
+			}
+			if (bitmap_set(tiles, pe.x, pe.y) < 0)
+				fatal("Out of memory.");
+		}
+	}
+
+	return;
+}
+
+/* A vertical line segment (x, y0) - (x, y1) is usable for a retangle if
+   all its tiles are candidates and it is part of a run of at least two
+   candidate tiles in that column. */
+inline static int
+has_line_segment(struct bitmap * tiles, uint32_t x, uint32_t y0, uint32_t y1)
+{
+	if (!bitmap_test_range(tiles, x, y0, y1))
+		return 0;
+	if (y0 != y1)
+		return 1;
+	return bitmap_test(tiles, x, y0 + 1) ||
+		(y0 > 0 && bitmap_test(tiles, x, y0 - 1));
+}
+
+/* Stretches the line segment (x, y0) - (x, y1) along the adjacent
+   columns as far as possible and adds the resulting retangle if its
+   dimension is within the limits. Its coordinates are filled in later
+   for all retangles of the zoom level at once. */
+inline static void
+add_retangle(struct list * retangles, struct bitmap * tiles, uint32_t z,
+	uint32_t x, uint32_t y0, uint32_t y1)
+{
+	struct retangle retangle;
+	uint32_t new_x, dim, height;
+
+	new_x = x;
+	height = y1 - y0 + 1;
+	dim = height;
+	while (dim <= RETANGLE_MAXDIM &&
+			has_line_segment(tiles, new_x + 1, y0, y1)) {
+		new_x++;
+		dim += height;
+	}
+	if (new_x == x || dim < RETANGLE_MINDIM || dim > RETANGLE_MAXDIM)
+		return;
+
+	retangle.z = z;
+	retangle.c1.x = x;
+	retangle.c1.y = y0;
+	retangle.c2.x = x;
+	retangle.c2.y = y1;	
+	retangle.c3.x = new_x;
+	retangle.c3.y = y0;
+	retangle.c4.x = new_x;
+	retangle.c4.y = y1;
+	retangle.lat = 0;
+	retangle.lng = 0;
+
+	if (list_append(retangles, &retangle) < 0) {
+		fatal("Out of memory.");
+	}
+}
+
+/* Converts the centers of the retangles found on zoom level z in one
+   batch and moves them over to the result list. */
+static void
+locate_retangles(struct list * retangles, struct list * found, uint32_t z)
+{
+	struct retangle retangle;
+	struct coord * centers;
+	double * lat, * lng;
+	uint32_t c, i;
+
+	c = list_count(found);
+	if (!c) return;
+
+	centers = malloc(sizeof(struct coord) * c);
+	lat = malloc(sizeof(double) * c);
+	lng = malloc(sizeof(double) * c);
+	if (!centers || !lat || !lng) fatal("Out of memory.");
+
+	for (i=0;i<c;i++) {
+		list_get(found, i, &retangle);
+		centers[i].x = retangle.c1.x +
+			((retangle.c4.x - retangle.c1.x + 1)/2);
+		centers[i].y = retangle.c1.y +
+			((retangle.c4.y - retangle.c1.y + 1)/2);
+	}
+
+	tile_to_coord_batch(z, centers, c, lat, lng);
+
+	for (i=0;i<c;i++) {
+		list_get(found, i, &retangle);
+		retangle.lat = lat[i];
+		retangle.lng = lng[i];
+		if (list_append(retangles, &retangle) < 0) {
+			fatal("Out of memory.");
+		}
+
+		verbose(3, "Retangle with z:%u, dim:%i ,[(%u,%u),(%u,%u),"
+			"(%u,%u),(%u,%u)] at %lf,%lf\n",
+			z, (retangle.c4.x - retangle.c1.x + 1) *
+			(retangle.c4.y - retangle.c1.y + 1),
+			retangle.c1.x, retangle.c1.y, retangle.c2.x,
+			retangle.c2.y, retangle.c3.x, retangle.c3.y,
+			retangle.c4.x, retangle.c4.y, retangle.lat, retangle.lng);
+	}
+
+	free(centers);
+	free(lat);
+	free(lng);
+}
+
+inline static void
+find_retangles_for_zoomlevel(struct list * retangles,
+	struct matches * matches, uint32_t z)
+{
+	struct bitmap * tiles;
+	struct list * xlist, * found;
+	uint32_t xcount, i, x, y0, y1, first_y, last_y, next_y;
+
+	tiles = matches->tiles[z];
+	if (!tiles) return;
+
+	found = list_new(sizeof(struct retangle));
+	if (!found) fatal("Out of memory.");
+
+	xlist = bitmap_getcolumns(tiles);
+	xcount = list_count(xlist);
+	for (i=0;i<xcount;i++) {
+		list_get(xlist, i, &x);
+
+		/* every run of at least two candidate tiles in this column
+		   gives line segments for all its sub ranges, anything higher
+		   than half the maximum dimension can never make it into a
+		   retangle though */
+		next_y = 0;
+		while (!bitmap_next_run(tiles, x, next_y, &first_y, &last_y)) {
+			next_y = last_y + 1;
+			if (first_y == last_y) continue;
+
+			verbose(3, "Found line segment from (%i,%i) - (%i,%i)\n",
+				x, first_y, x, last_y);
+
+			for (y0=first_y;y0<=last_y;y0++) {
+				for (y1=y0;y1<=last_y &&
+					2*(y1-y0+1) <= RETANGLE_MAXDIM;y1++) {
+					add_retangle(found, tiles, z,
+						x, y0, y1);
+				}
+			}
+		}
+	}
+
+	list_free(xlist);
+
+	locate_retangles(retangles, found, z);
+	list_free(found);
+
+	return;
+}
+
+struct list *
+find_retangles(struct matches * matches, uint32_t zmask)
+{
+	struct list * retangles;
+	uint32_t z, c;
+
+	verbose(2, "Looking for retangles\n");
+
+	retangles = list_new(sizeof(struct retangle));
+
+	for (z=0;z<MAX_Z;z++) {
+		if (!(zmask & (1 << z))) continue;
+		c = list_count(retangles);
+		find_retangles_for_zoomlevel(retangles, matches, z);
+		zstats[z].found += list_count(retangles) - c;
+	}
+
+	return retangles;
+}
+
+/* The retangles have been found and their lat/lng values have been
+   calcuated. Add all the retangles to a histogram and cluster the
+   information on their lat/lng values. Based on that infer the actual
+   locations the user is looking at. We cheat again and just use the
+   map entry pointer as the counter. */
+void
+cluster_retangles(struct list * retangles, double * lat, double * lng)
+{
+	struct retangle r;
+	struct map * latmap, * lngmap;
+	struct list * keys;
+	uint32_t c, i, rcount, ilat, ilng, * intptr;
+	double dlat, dlng, dc, scale;
+
+	rcount = list_count(retangles);
+	latmap = map_new(1009);
+	lngmap = map_new(1009);
+	scale = 10000.0;
+	for(i=0;i<rcount;i++) {
+		if (list_get(retangles, i, &r) < 0)
+			fatal("Unexpected error in list_get");
+		ilat = (uint32_t)(r.lat * scale);
+		ilng = (uint32_t)(r.lng * scale);
+		if (map_get(latmap, ilat) < 0) map_set(latmap, ilat, (void *)1);
+		else map_set(latmap, ilat, map_get(latmap, ilat) + 1);
+		if (map_get(lngmap, ilng) < 0) map_set(lngmap, ilng, (void *)1);
+		else map_set(lngmap, ilng, map_get(lngmap, ilng) + 1);
+	}
+
+	rcount = map_count(latmap);
+	keys = map_getkeys(latmap, 1);
+	dlat = 0;
+	dc = 0.0;
+	for (i=0;i<rcount;i++) {
+		list_get(keys, i, &c);
+		intptr = map_get(latmap, c);
+		dlat += ((double)(((int)c)/scale) * (uint32_t)(uintptr_t)intptr);
+		dc+=(1.0 * (uint32_t)(uintptr_t)intptr);
+	}
+	dlat = dlat/dc;
+	list_free(keys);
+
+	rcount = map_count(lngmap);
+	keys = map_getkeys(lngmap, 1);
+	dlng = 0;
+	dc = 0.0;
+	for (i=0;i<rcount;i++) {
+		list_get(keys, i, &c);
+		intptr = map_get(lngmap, c);
+		dlng += ((double)(((int)c)/scale) * (uint32_t)(uintptr_t)intptr);
+		dc+=(1.0 * (uint32_t)(uintptr_t)intptr);
+	}
+	dlng = dlng/dc;
+	list_free(keys);
+
+	map_free(latmap, NULL);
+	map_free(lngmap, NULL);
+
+	*lat = dlat;
+	*lng = dlng;
+}
+
+/* EOF */
@@ -0,0 +1,52 @@
+/* gmaps-analyze.h */
+
+#ifndef GMAPS_ANALYZE_H
+  #define GMAPS_ANALYZE_H
+
+#include <stdint.h>
+
+#include "gmaps.h"
+#include "bitmap.h"
+
+/* candidate tiles of one analysis window, one bitmap per zoom level */
+struct matches {
+	struct bitmap * tiles[MAX_Z];
+};
+
+/* per zoom level matching counters, used to find the hot zoom levels */
+struct zoom_stats {
+	uint64_t candidates;
+	uint64_t retangles;
+	uint64_t windows;
+	uint64_t skipped;
+	uint32_t idle;
+	uint32_t found;
+};
+
+/* candidate retangle of tiles, its corners and the coordinates of its
+   center */
+struct retangle {
+	uint8_t z;
+	struct coord c1;
+	struct coord c2;
+	struct coord c3;
+	struct coord c4;
+	double lat;
+	double lng;
+};
+
+extern struct zoom_stats zstats[MAX_Z];
+
+struct matches * matches_new();
+void matches_free(struct matches *);
+void matches_add(struct profile *, uint32_t, struct matches **,
+	const struct http_entry *, uint32_t);
+struct list * find_retangles(struct matches *, uint32_t);
+void cluster_retangles(struct list *, double *, double *);
+
+/* provided by the program using the analysis */
+void verbose(int, const char *, ...);
+
+#endif
+
+/* EOF */
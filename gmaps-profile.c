@@ -19,7 +19,7 @@
 
 static char * gmap_catcher_cache_path;
 
-static struct map * profile_map;
+static struct profile * profile;
 
 static unsigned int tiles_missing = 0;
 static unsigned int tiles_found = 0;
@@ -41,7 +41,6 @@ coord_to_path(int z, int x, int y)
 static void
 query_region(int xmin, int xmax, int ymin, int ymax, int zoom)
 {
-	struct list * list;
 	struct profile_entry pe;
 	off_t file_size;
 	struct stat st;
@@ -69,17 +68,10 @@ query_region(int xmin, int xmax, int ymin, int ymax, int zoom)
 				pe.x = x;
 				pe.y = y;
 				pe.z = zoom;
+				pe.id = 0;
 
-				list = map_get(profile_map, file_size);
-				if (!list) {
-					list = list_new(
-						sizeof(struct profile_entry));
-					if (!list) fatal("Out of memory.");
-					if (map_set(profile_map, file_size,
-							list) < 0)
-						fatal("Out of memory.");
-				}
-				list_append(list, &pe);
+				if (profile_add(profile, file_size, &pe) < 0)
+					fatal("Out of memory.");
 
 				if (verbose) {
 					printf("Found: (%i,%i,%i), size: %lu\n",
@@ -134,6 +126,8 @@ usage(const char * argv0)
 	fprintf(stderr, " the existing data in the file\n");
 	fprintf(stderr, "-d <cachedir>  - gmapcatcher cache directory\n");
 	fprintf(stderr, "                 (default: $HOME/.googlemaps/)\n");
+	fprintf(stderr, "-e             - write the compact encoded");
+	fprintf(stderr, " profile format\n");
 	fprintf(stderr, "-f <filename>  - write data to this file\n");
 	fprintf(stderr, "                 (default: ./%s)\n", DEFAULT_FN);
 	fprintf(stderr, "-v             - be verbose\n");
@@ -144,22 +138,17 @@ usage(const char * argv0)
 int
 main(int argc, char ** argv, char ** envp)
 {
-	FILE * f;
-	struct list * list;
 	struct stat st;
-	struct profile_entry pe;
 	char * filename = DEFAULT_FN, * tmp, * arg0;
 	char buf[4096];
-	size_t off;
 	double lng, lat, lat_range, lng_range;
 	double latitude = -1.0, longitude = -1.0;
-	unsigned int i, j;
-	int max_zl = 17, min_zl = 2, merge = 0;
+	int max_zl = 17, min_zl = 2, merge = 0, encoded = 0;
 	int c, zl;
 
 	arg0 = (argc > 0 ? argv[0] : "(unknown)");
 
-	while ((c = getopt(argc, argv, "d:f:hmva:o:")) != -1) {
+	while ((c = getopt(argc, argv, "d:ef:hmva:o:")) != -1) {
 		switch (c) {
 			case 'a':
 				sscanf(optarg, "%lf", &latitude);
@@ -170,6 +159,9 @@ main(int argc, char ** argv, char ** envp)
 			case 'd':
 				gmap_catcher_cache_path = optarg;
 				break;
+			case 'e':
+				encoded = 1;
+				break;
 			case 'f':
 				filename = optarg;
 				break;
@@ -226,12 +218,12 @@ main(int argc, char ** argv, char ** envp)
 	}
 
 	if (merge) {
-		profile_map = profile_load(filename);
-		if (!profile_map) fatal("Error while opening profile!");
+		profile = profile_load(filename);
+		if (!profile) fatal("Error while opening profile!");
 	}
 	else {
-		profile_map = map_new(PROFILEMAP_HASHSIZE);
-		if (!profile_map) fatal("Cannot create profile!");
+		profile = profile_new();
+		if (!profile) fatal("Cannot create profile!");
 	}
 
 
@@ -246,32 +238,12 @@ main(int argc, char ** argv, char ** envp)
 
 	printf("Writing out %sprofile.\n", (merge ? "merged " : ""));
 
-	f = fopen(filename, "w+");
-	for (i=0;i<PROFILEMAP_HASHSIZE;i++) {
-
-		write_uint16(f, i & 0xFFFF);
-
-		list = map_get(profile_map, i);
-		if (!list) {
-			write_uint32(f, 0);
-			continue;
-		}
-
-		off = list_count(list);
-		write_uint32(f, off & 0xFFFF);
-
-		for (j=0;j<off;j++) {
-			if (list_get(list, j, &pe) < 0)
-				fatal("Error while retrieving data.");
-			write_uint32(f, pe.x);
-			write_uint32(f, pe.y);
-			write_uint8(f, pe.z);
-		}
-	}
+	if (profile_save(profile, filename, encoded) < 0)
+		fatal("Cannot write profile!");
 
 	printf("Done.\n");
 
-	profile_unload(profile_map);
+	profile_unload(profile);
 
 	exit(EXIT_SUCCESS);
 }
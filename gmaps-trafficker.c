@@ -1,6 +1,9 @@
 /* gmaps-trafficker.c */
 
+#include <dirent.h>
 #include <errno.h>
+#include <glob.h>
+#include <limits.h>
 #include <netdb.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -13,19 +16,53 @@
 #include <netdb.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "libtrafficker.h"
 #include "gmaps.h"
+#include "gmaps-analyze.h"
+#include "bitmap.h"
+#include "burstlog.h"
+#include "hist.h"
+#include "probes.h"
+
+/* What the capture process keeps of a flow to pair its bursts: only the
+   last client burst still waiting for its response. Flows sharing the
+   low half of their hash are chained off the same sessionmap entry. */
+struct flow_state {
+	uint64_t hash;
+	uint32_t chost;
+	uint32_t dhost;
+	uint16_t cport;
+	uint16_t dport;
+	int pending;
+	size_t reqlen;
+	struct flow_state * next;
+};
+
+/* A prefix of addresses of the Google Maps servers, in host byte
+   order. */
+struct server_prefix {
+	uint32_t addr;
+	uint32_t len;
+};
 
 struct trafficker * tr = NULL;
-struct map * profilemap = NULL;
+struct profile * profile = NULL;
+static struct list * servers = NULL;
+static const char * region_names[MAX_REGIONS];
+static uint32_t nr_regions = 0;
 struct map * sessionmap = NULL;
-struct map * tsmap = NULL;
+static struct flow_state * free_flows = NULL;
+/* the req/res pairs received since the last window was analyzed */
+static struct list * window_pairs = NULL;
 static int child_died = 0;
 static int int_received = 0;
 static int verbose_level = 0;
@@ -33,25 +70,70 @@ static int live_mode = 0;
 static int capture_fd = 0;
 static int analyze_fd = 0;
 static int colorize_output = 0;
+static uint32_t zoom_mask = ZOOM_ALL;
+static uint32_t windows_analyzed = 0;
+static char ** capture_files = NULL;
+static uint32_t nr_capture_files = 0;
+static const char * record_fn = NULL;
+static struct burstlog * record_log = NULL;
+static const char * export_fn = NULL;
+static int stats_requested = 0;
+static volatile sig_atomic_t stats_due = 0;
+static time_t stats_interval = STATS_INTERVAL;
+static const char * stats_fn = NULL;
+static uint64_t bursts_seen = 0;
+static uint64_t entries_sent = 0;
+static uint64_t entries_received = 0;
+static int replay_mode = 0;
+static int replay_stop = 0;
+static time_t replay_from = 0;
+static time_t replay_to = 0;
+static uint32_t burst_gap = 0;
+static uint64_t window_usec = ANALYZE_WINDOW_MS * 1000ULL;
+
+/* stages of the way from the last packet of a tile to its location
+   estimate, each has a latency histogram in nanoseconds */
+enum latency_stage {
+	LAT_JOIN,		/* reassembled until the burst is handed over */
+	LAT_PIPE,		/* handed over until read by the analyzer */
+	LAT_WINDOW,		/* read until its window gets analyzed */
+	LAT_MATCHES,		/* matching all pairs of a window */
+	LAT_RETANGLES,		/* finding the retangles of a window */
+	LAT_CLUSTER,		/* clustering the retangles of a window */
+	LAT_TOTAL,		/* newest reassembled pair until reported */
+	LAT_STAGES
+};
 
-struct matches {
-	size_t off;
-	size_t max;
-	struct map * xseen;
-	struct map *** xmaps;
+static const char * latency_names[LAT_STAGES] = {
+	"join", "pipe", "window", "matches", "retangles", "cluster", "total"
 };
 
-struct retangle {
-	uint8_t z;
-	struct coord c1;
-	struct coord c2;
-	struct coord c3;
-	struct coord c4;
-	double lat;
-	double lng;
+static struct hist latency[LAT_STAGES];
+
+/* counters a capture process sends to the analyzer */
+struct capture_stats {
+	struct trafficker_stats tr;
+	uint64_t bursts;
+	uint64_t entries;
 };
 
-static void
+/* capture process reading one file of a set of capture files, the
+   entries it sent are queued by timestamp until they can be merged */
+struct worker {
+	pid_t pid;
+	int fd;
+	int done;
+	char buf[4096];
+	size_t buflen;
+	struct http_entry * queue;
+	uint32_t head;
+	uint32_t count;
+	uint32_t alloc;
+	uint64_t newest;
+	struct capture_stats stats;
+};
+
+void
 verbose(int level, const char * fmt, ...)
 {
 	va_list ap;
@@ -78,434 +160,331 @@ warning(const char * fmt, ...)
 	fflush(stdout);
 }
 
-static struct matches *
-matches_new()
+/* Wall clock time in microseconds, live windows are measured with it. */
+static uint64_t
+wallclock_usec()
 {
-	struct matches * m;
-	uint32_t i, j;
-
-	m = xmalloc(sizeof(struct matches));
-	m->off = 0;
-	m->max = 50;
-
-	m->xmaps = xmalloc(sizeof(struct map **) * MAX_Z);
-	for (i=0;i<MAX_Z;i++) {
-		m->xmaps[i] = xmalloc(sizeof(struct map *) * m->max);
-		for (j=0;j<m->max;j++) {
-			m->xmaps[i][j] = map_new(1009);
-			if (!(m->xmaps[i][j])) fatal("Out of memory.");
-		}
-	}
-
-	m->xseen = map_new(1009);
-	if (!(m->xseen)) fatal("Out of memory.");
+	struct timeval tv;
 
-	return m;	
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
+/* Analyzes the pairs received since the last window, their timestamps
+   span first_ts to last_ts in microseconds. Every pair goes into the
+   window it was received in, even when it started earlier, so pairs
+   handed over late still get analyzed exactly once. */
 static void
-matches_free(struct matches * m)
+analyze(uint64_t first_ts, uint64_t last_ts)
 {
-	uint32_t i,j;
-
-	for(i=0;i<MAX_Z;i++) {
-		for(j=0;j<m->max;j++) {
-			map_free(m->xmaps[i][j], _list_free);
+	struct http_entry hte;
+	struct matches * matches[MAX_REGIONS];
+	struct list * retangles;
+	uint32_t c, j, z, rcount, zmask, pairs, nr_retangles;
+	uint64_t start, newest, t0, t_retangles, t_cluster, candidates, i;
+	double dlat, dlng;
+
+	verbose(2, "Analyzing time frame of %.3fs\n",
+		(last_ts - first_ts) / 1e6);
+	start = monotonic_ns();
+	newest = 0;
+
+	/* skip the zoom levels which went idle, except for the windows
+	   where all of them get probed again */
+	zmask = zoom_mask;
+	for (z=0;z<MAX_Z;z++) {
+		if (!(zmask & (1 << z))) continue;
+		zstats[z].found = 0;
+		if (zstats[z].idle >= ZOOM_IDLE_WINDOWS &&
+				windows_analyzed % ZOOM_PROBE_WINDOWS) {
+			zmask &= ~(1 << z);
+			zstats[z].skipped++;
 		}
-		free(m->xmaps[i]);
+		else zstats[z].windows++;
 	}
-	map_free(m->xseen, NULL);
-	free(m->xmaps);
-	free(m);
-}
+	windows_analyzed++;
+	PROBE3(gmaps, window_start, first_ts, last_ts, zmask);
 
-static void
-matches_add(struct matches * matches, struct http_entry * hte)
-{
-	struct map * map;
-	struct list * pflist, * ylist;
-	struct profile_entry pe;
-	uint32_t i, j, c;
-	size_t reslen, minreslen, maxreslen;	
+	candidates = 0;
+	for (z=0;z<MAX_Z;z++) candidates -= zstats[z].candidates;
+	pairs = nr_retangles = 0;
 
-	reslen = hte->reslen;
-	if (reslen < MIN_TILE_LEN || reslen > MAX_TILE_LEN) {
-		verbose(3, "Ignoring entry because not in tile range!: %lu\n",
-			reslen);
-		return;
+	for (i=0;i<nr_regions;i++) {
+		matches[i] = matches_new();
 	}
+	
+	/* Retrieve the HTTP response sizes and add them to the matches 
+	   if the corresponding HTTP request size fits with the average 
+	   HTTP response size for satellite tiles (as computed above by
+	   means of the histogram). */
+	c = list_count(window_pairs);
+	for(j=0;j<c;j++) {
+		if (list_get(window_pairs, j, &hte) < 0) {
+			fatal("Unexpected error in list_get");
+		}
+		matches_add(profile, nr_regions, matches, &hte, zmask);
+		pairs++;
 
-	if (matches->off == matches->max) {
-		warning("Cannot add new matches, match limit is reached!\n");
-		return;
+		hist_add(&(latency[LAT_JOIN]), hte.ts_emit - hte.ts_data);
+		hist_add(&(latency[LAT_PIPE]), hte.ts_recv - hte.ts_emit);
+		hist_add(&(latency[LAT_WINDOW]), start - hte.ts_recv);
+		if (hte.ts_data > newest) newest = hte.ts_data;
 	}
+	list_free(window_pairs);
+	window_pairs = list_new(sizeof(struct http_entry));
+	if (!window_pairs) fatal("Out of memory.");
+	hist_add(&(latency[LAT_MATCHES]), monotonic_ns() - start);
+
+	t_retangles = t_cluster = 0;
+	for (i=0;i<nr_regions;i++) {
+		t0 = monotonic_ns();
+		retangles = find_retangles(matches[i], zmask);
+		t_retangles += monotonic_ns() - t0;
+		rcount = list_count(retangles);
+		nr_retangles += rcount;
+		if (!rcount) verbose(2, "No retangles found\n");
+		else verbose(2, "Found %u retangle%s\n", rcount,
+			(rcount == 1?"":"s"));
+
+		/* with multiple regions only report the ones that had any
+		   matching retangles at all */
+		if (nr_regions == 1) {
+			t0 = monotonic_ns();
+			cluster_retangles(retangles, &dlat, &dlng);
+			t_cluster += monotonic_ns() - t0;
+			verbose(0, "Lat: %lf, Lng: %lf\n", dlat, dlng);
+		}
+		else if (rcount) {
+			t0 = monotonic_ns();
+			cluster_retangles(retangles, &dlat, &dlng);
+			t_cluster += monotonic_ns() - t0;
+			verbose(0, "%s: Lat: %lf, Lng: %lf\n",
+				region_names[i], dlat, dlng);
+		}
 
-	/* establish the lower and upper bounds for the match search */
-	minreslen = reslen - TILE_LEN_RANGE;
-	if (minreslen < MIN_TILE_LEN || minreslen > reslen)
-		minreslen = MIN_TILE_LEN;
-	maxreslen = reslen + TILE_LEN_RANGE;
-	if (maxreslen > MAX_TILE_LEN || maxreslen < reslen)
-		maxreslen = MAX_TILE_LEN;
-
-	/* build the list of all matches for the input HTTP request */
-	for (i=minreslen;i<=maxreslen;i++) {
-
-		pflist = map_get(profilemap, i);
-		if (!pflist) continue;
-
-		c = list_count(pflist);
-		for (j=0;j<c;j++) {
-			if (list_get(pflist, j, &pe) < 0) {
-				fatal("Unexpected error in list_get");
-			}
-
-			/* quick sanity check */
-			if (pe.z < 0 || pe.z >= MAX_Z ||
-				pe.x < 0 || pe.x >= MAX_X ||
-				pe.y < 0 || pe.y >= MAX_Y)
-				continue;
-
-			map = matches->xmaps[pe.z][matches->off];
-			ylist = map_get(map, pe.x);
-			if (!ylist) {
-				ylist = list_new(sizeof(uint32_t));
-				if (!ylist) fatal("Out of memory.");
-				if (map_set(map, pe.x, ylist) < 0)
-					fatal("Out of memory.");
-			}
+		list_free(retangles);
+		matches_free(matches[i]);
+	}
 
-			if (list_append(ylist, &(pe.y)) < 0)
-				fatal("Out of memory.");
+	/* only windows with pairs in them lead to an estimate */
+	if (newest) {
+		hist_add(&(latency[LAT_RETANGLES]), t_retangles);
+		hist_add(&(latency[LAT_CLUSTER]), t_cluster);
+		hist_add(&(latency[LAT_TOTAL]), monotonic_ns() - newest);
+	}
 
-			map_set(matches->xseen, pe.x, (void *)1);
-		}
+	for (z=0;z<MAX_Z;z++) {
+		if (!(zmask & (1 << z))) continue;
+		zstats[z].retangles += zstats[z].found;
+		if (zstats[z].found) zstats[z].idle = 0;
+		else zstats[z].idle++;
 	}
 
-	matches->off++;
-	return;
+	for (z=0;z<MAX_Z;z++) candidates += zstats[z].candidates;
+	PROBE5(gmaps, window_end, first_ts, pairs, candidates, nr_retangles,
+		monotonic_ns() - start);
 }
 
 static void
-add_segment_variations(struct map * results, uint32_t x, 
-	uint32_t first_y, uint32_t last_y)
-{
-	struct list * list;
-	uint32_t i, j;
-	uint32_t tmp[2];
-
-	for (i=first_y;i<last_y+1;i++) {
-		for (j=i;j<last_y+1;j++) {
-			list = map_get(results, x);
-			if (!list) {
-				list = list_new(sizeof(tmp));
-				if (map_set(results, x, list) < 0)
-					fatal("Out of memory.");
-			}
-			tmp[0] = i;
-			tmp[1] = j;
-
-			if (!list_contains(list, &tmp)) {
-				if (list_append(list, &tmp) < 0) {
-					fatal("Out of memory.");
-				}
-				verbose(3,
-				"Found line segment from (%i,%i) - (%i,%i)\n",
-				x,i,x,j);
-			}
-		}
-	}	
-}
-
-
-static struct map *
-get_line_segments(struct list * xlist, struct map ** maps, size_t mapcount)
+print_zoom_stats()
 {
-	uint32_t * intptr;
-	uint32_t xcount, ycount, listcount, i, x, y, c, k;
-	uint32_t first_y, last_y, tmp_y;
-	struct map * results, * xmap, * ymap;
-	struct list * list, * ysortedlist;
-
-	results = map_new(1009);
-	ymap = map_new(1009);	
-	if (!results || !ymap) fatal("Out of memory.");
-
-	xcount = list_count(xlist);
-	for (i=0;i<xcount;i++) {
-
-		if (list_get(xlist, i, &x) < 0) 
-			fatal("Unexpected error in list_get");
-
-		if (!ymap) {
-			ymap = map_new(1009);
-			if (!ymap) fatal("Out of memory.");
-		}
-
-		for (c=0;c<mapcount;c++) {
-			xmap = maps[c];	
-			if (!xmap) continue;
-			list = map_get(xmap, x);	
-			if (!list) continue;
-
-			listcount = list_count(list);
-			for (k=0;k<listcount;k++) {
-				if (list_get(list, k, &y) < 0) 
-					fatal("Unexpected error in list_get");
-				intptr = map_get(ymap, y);	
-				if (!intptr) intptr = (void *)1;
-				else intptr++;
-				map_set(ymap, y, intptr);
-			}
-		}
-
-		ycount = map_count(ymap);
-		if (!ycount) continue;
-
-		ysortedlist = map_getkeys(ymap, 1);
-		list_get(ysortedlist, 0, &first_y);
-		last_y = first_y;
-		tmp_y = 0;
-
-		for (c=1;c<ycount;c++) {
-			list_get(ysortedlist, c, &tmp_y);
-			if (tmp_y == last_y + 1) {
-				last_y = tmp_y;
-			}		
-			else if (first_y != last_y) {
-				add_segment_variations(results, x,
-					first_y, last_y);
-			}
-			else {
-				first_y = last_y = tmp_y;
-			}
-		}
+	uint32_t z;
 
-		list_free(ysortedlist);
-		map_free(ymap, NULL);
-		ymap = NULL;
+	for (z=0;z<MAX_Z;z++) {
+		if (!(zoom_mask & (1 << z))) continue;
+		verbose(1, "Zoom %2u: %s, %llu candidates, %llu retangles,"
+			" %llu of %llu windows skipped\n", z,
+			(zstats[z].idle >= ZOOM_IDLE_WINDOWS ? "cold" : "hot"),
+			(unsigned long long)zstats[z].candidates,
+			(unsigned long long)zstats[z].retangles,
+			(unsigned long long)zstats[z].skipped,
+			(unsigned long long)(zstats[z].skipped +
+				zstats[z].windows));
 	}
-
-	if (ymap) map_free(ymap, NULL);
-
-	return results;
 }
 
-inline static void
-find_retangles_for_zoomlevel(struct list * retangles,
-	struct matches * matches, struct list * xvals,
-	uint32_t z)
+/* Adds up the counters of several capture processes, they are all
+   uint64_t. */
+static void
+stats_add(struct capture_stats * sum, const struct capture_stats * cs)
 {
-	struct coord coord;
-	struct retangle retangle;
-	struct list * keylist, * ylist, * ylist2;
-	struct map * xsegs;
-	uint32_t keycount, i, j, k, l, ycount, ycount2, new_x, found;
-	uint32_t x, x2, y[2], y2[2];
-	uint32_t dim, mindim, maxdim;
-
-	xsegs = get_line_segments(xvals, matches->xmaps[z], matches->off);	
-	mindim = 3;
-	maxdim = 18;
-	
-	keylist = map_getkeys(xsegs, 1);
-	keycount = list_count(keylist);
-	for (i=0;i<keycount;i++) {
-		list_get(keylist, i, &x);
-		ylist = map_get(xsegs, x);
-		ycount = list_count(ylist);	
-
-		for (j=0;j<ycount;j++) {
-			list_get(ylist, j, &y);
-			new_x = x;
-
-			for(k=i+1;k<keycount;k++) {
-				found = 0;
-
-				list_get(keylist, k, &x2);
-				ylist2 = map_get(xsegs, x2);
-				ycount2 = list_count(ylist2);
-				
-				for(l=0;l<ycount2;l++) {
-					list_get(ylist2, l, &y2);
-					if (y[0]==y2[0] && y[1]==y2[1]) {
-						found = 1;
-						new_x = x2;
-						break;
-					}
-				}
-				if (!found)
-					break;
-			}
-			if (new_x != x) {
-				dim = ((y[1]-y[0]+1) * (x2-x+1));
-				if (dim >= mindim && dim <= maxdim) {
-
-					retangle.z = z;
-					retangle.c1.x = x;
-					retangle.c1.y = y[0];
-					retangle.c2.x = x;
-					retangle.c2.y = y[1];	
-					retangle.c3.x = new_x;
-					retangle.c3.y = y[0];
-					retangle.c4.x = new_x;
-					retangle.c4.y = y[1];
-
-					coord.x = x + ((new_x - x + 1)/2);
-					coord.y = y[0] + ((y[1] - y[0] + 1)/2);
-
-					tile_to_coord(z, &coord, 0, 0,
-						&(retangle.lat), &(retangle.lng)
-					);
-
-					if (list_append(retangles,
-						&retangle) < 0) {
-						fatal("Out of memory.");
-					}
-
-					verbose(3, "Retangle with z:%u, dim:%i"
-						" ,[(%u,%u),(%u,%u),"
-						"(%u,%u),(%u,%u)] at"
-						" %lf,%lf\n",
-						z, dim,
-						x, y[0], x, y[1],
-						new_x, y[0], new_x, y[1],
-						retangle.lat, retangle.lng);
-				}
-			}
-		}
-	}
-
-	list_free(keylist);
-	map_free(xsegs, _list_free);
+	const uint64_t * src = (const uint64_t *)cs;
+	uint64_t * dst = (uint64_t *)sum;
+	size_t i;
 
-	return;
+	for (i=0;i<sizeof(struct capture_stats)/sizeof(uint64_t);i++)
+		dst[i] += src[i];
 }
 
-static struct list *
-find_retangles(struct matches * matches)
+static uint64_t
+pipe_backlog(int fd)
 {
-	struct list * xvals, * retangles;
-	uint32_t z;
-
-	verbose(2, "Looking for retangles\n");
+	int n;
 
-	retangles = list_new(sizeof(struct retangle));
-
-	xvals = map_getkeys(matches->xseen, 0);
-	if (!xvals) fatal("Out of memory.");
-
-	for (z=0;z<MAX_Z;z++) {
-		find_retangles_for_zoomlevel(retangles, matches, xvals, z);
-	}
-	list_free(xvals);
-
-	return retangles;
+	if (fd < 0 || ioctl(fd, FIONREAD, &n) < 0) return 0;
+	return n;
 }
 
+/* Writes the counters to the statistics file, one "name value" pair per
+   line. The file is replaced at once so readers never see half of it. */
 static void
-analyze(time_t first_ts, time_t last_ts)
+write_stats_file(const struct capture_stats * cs, uint64_t backlog)
 {
-	struct retangle r;
-	struct http_entry hte;
-	struct matches * matches;
-	struct map * latmap, * lngmap;
-	struct list * htelist, * retangles, * keys;
-	uint32_t c, i, j, rcount, ilat, ilng, * intptr;
-	double dlat, dlng, dc, scale;
-
-	verbose(2, "Analyzing time frame of %us\n", last_ts - first_ts);
+	static const double percentiles[] = { 50, 90, 99, 99.9 };
+	static const char * percentile_names[] = {
+		"p50", "p90", "p99", "p999"
+	};
+	const struct trafficker_stats * st = &(cs->tr);
+	const struct hist * h;
+	char * tmpfn;
+	uint32_t i, j;
+	FILE * fp;
+
+	tmpfn = xmalloc(strlen(stats_fn) + 5);
+	sprintf(tmpfn, "%s.tmp", stats_fn);
+	fp = fopen(tmpfn, "w");
+	if (!fp) {
+		warning("Cannot write statistics to %s\n", tmpfn);
+		free(tmpfn);
+		return;
+	}
 
-	matches = matches_new();
-	
-	/* Retrieve the HTTP response sizes and add them to the matches 
-	   if the corresponding HTTP request size fits with the average 
-	   HTTP response size for satellite tiles (as computed above by
-	   means of the histogram). */
-	for (i=first_ts;i<=last_ts;i++) {
-		htelist = map_get(tsmap, i);
-		if (!htelist) continue;
-		
-		c = list_count(htelist);	
-		for(j=0;j<c;j++) {
-			if (list_get(htelist, j, &hte) < 0) {
-				fatal("Unexpected error in list_get");
-			}
-			matches_add(matches, &hte);
+	fprintf(fp, "time %llu\n", (unsigned long long)time(NULL));
+	fprintf(fp, "packets %llu\n", (unsigned long long)st->packets);
+	fprintf(fp, "packets_skipped %llu\n",
+		(unsigned long long)st->packets_skipped);
+	fprintf(fp, "pcap_received %llu\n",
+		(unsigned long long)st->pcap_received);
+	fprintf(fp, "pcap_dropped %llu\n",
+		(unsigned long long)st->pcap_dropped);
+	fprintf(fp, "pcap_ifdropped %llu\n",
+		(unsigned long long)st->pcap_ifdropped);
+	fprintf(fp, "flows %llu\n", (unsigned long long)st->flows);
+	fprintf(fp, "flows_closed %llu\n",
+		(unsigned long long)st->flows_closed);
+	fprintf(fp, "flows_reset %llu\n",
+		(unsigned long long)st->flows_reset);
+	fprintf(fp, "flows_timed_out %llu\n",
+		(unsigned long long)st->flows_timed_out);
+	fprintf(fp, "flows_skipped %llu\n",
+		(unsigned long long)st->flows_skipped);
+	fprintf(fp, "sessions_open %llu\n",
+		(unsigned long long)st->sessions_open);
+	fprintf(fp, "bytes_reassembled %llu\n",
+		(unsigned long long)st->bytes_reassembled);
+	fprintf(fp, "bytes_skipped %llu\n",
+		(unsigned long long)st->bytes_skipped);
+	fprintf(fp, "ssl_records %llu\n", (unsigned long long)st->ssl_records);
+	fprintf(fp, "bursts %llu\n", (unsigned long long)cs->bursts);
+	fprintf(fp, "entries_sent %llu\n", (unsigned long long)cs->entries);
+	fprintf(fp, "entries_received %llu\n",
+		(unsigned long long)entries_received);
+	fprintf(fp, "windows_analyzed %u\n", windows_analyzed);
+	fprintf(fp, "pipe_backlog %llu\n", (unsigned long long)backlog);
+	for (i=0;i<LAT_STAGES;i++) {
+		h = &(latency[i]);
+		fprintf(fp, "latency_%s_count %llu\n", latency_names[i],
+			(unsigned long long)h->count);
+		for (j=0;j<sizeof(percentiles)/sizeof(double);j++) {
+			fprintf(fp, "latency_%s_%s_ns %llu\n",
+				latency_names[i], percentile_names[j],
+				(unsigned long long)hist_percentile(h,
+					percentiles[j]));
 		}
+		fprintf(fp, "latency_%s_max_ns %llu\n", latency_names[i],
+			(unsigned long long)h->max);
 	}
 
-	retangles = find_retangles(matches);
-	rcount = list_count(retangles);
-	if (!rcount) verbose(2, "No retangles found\n");
-	else verbose(2, "Found %u retangle%s\n", rcount, (rcount == 1?"":"s"));
-
-	/* The retangles have been found and their lat/lng values have been
-	   calcuated. Add all the retangles to a histogram and cluster the
-	   information on their lat/lng values. Based on that infer the actual
-	   locations the user is looking at. We cheat again and just use the
-	   map entry pointer as the counter. */
-	latmap = map_new(1009);
-	lngmap = map_new(1009);
-	scale = 10000.0;
-	for(i=0;i<rcount;i++) {
-		if (list_get(retangles, i, &r) < 0)
-			fatal("Unexpected error in list_get");
-		ilat = (uint32_t)(r.lat * scale);
-		ilng = (uint32_t)(r.lng * scale);
-		if (map_get(latmap, ilat) < 0) map_set(latmap, ilat, (void *)1);
-		else map_set(latmap, ilat, map_get(latmap, ilat) + 1);
-		if (map_get(lngmap, ilng) < 0) map_set(lngmap, ilng, (void *)1);
-		else map_set(lngmap, ilng, map_get(lngmap, ilng) + 1);
-	}
+	if (fclose(fp) || rename(tmpfn, stats_fn) < 0)
+		warning("Cannot write statistics to %s\n", stats_fn);
+	free(tmpfn);
+}
 
-	rcount = map_count(latmap);
-	keys = map_getkeys(latmap, 1);
-	dlat = 0;
-	dc = 0.0;
-	for (i=0;i<rcount;i++) {
-		list_get(keys, i, &c);
-		intptr = map_get(latmap, c);
-		dlat += ((double)(((int)c)/scale) * *(uint32_t *)&intptr);
-		dc+=(1.0 * *(uint32_t *)&intptr);
+static void
+print_latencies(int level)
+{
+	const struct hist * h;
+	uint32_t i;
+
+	for (i=0;i<LAT_STAGES;i++) {
+		h = &(latency[i]);
+		if (!h->count) continue;
+		verbose(level, "Latency %-9s: p50 %.3fms, p90 %.3fms,"
+			" p99 %.3fms, p99.9 %.3fms, max %.3fms (%llu)\n",
+			latency_names[i],
+			hist_percentile(h, 50) / 1e6,
+			hist_percentile(h, 90) / 1e6,
+			hist_percentile(h, 99) / 1e6,
+			hist_percentile(h, 99.9) / 1e6,
+			h->max / 1e6, (unsigned long long)h->count);
 	}
-	dlat = dlat/dc;
-	list_free(keys);
+}
 
-	rcount = map_count(lngmap);
-	keys = map_getkeys(lngmap, 1);
-	dlng = 0;
-	dc = 0.0;
-	for (i=0;i<rcount;i++) {
-		list_get(keys, i, &c);
-		intptr = map_get(lngmap, c);
-		dlng += ((double)(((int)c)/scale) * *(uint32_t *)&intptr);
-		dc+=(1.0 * *(uint32_t *)&intptr);
-	}
-	dlng = dlng/dc;
-	list_free(keys);
+/* Prints the counters of the capture processes as last sent by them
+   together with the ones of the analyzer. */
+static void
+report_stats(int level, const struct capture_stats * cs, uint64_t backlog)
+{
+	const struct trafficker_stats * st = &(cs->tr);
+
+	verbose(level, "Stats: %llu packets (%llu of other hosts skipped),"
+		" %llu dropped (%llu by the interface), %llu flows (%llu"
+		" open, %llu closed, %llu reset, %llu timed out, %llu"
+		" skipped)\n",
+		(unsigned long long)st->packets,
+		(unsigned long long)st->packets_skipped,
+		(unsigned long long)st->pcap_dropped,
+		(unsigned long long)st->pcap_ifdropped,
+		(unsigned long long)st->flows,
+		(unsigned long long)st->sessions_open,
+		(unsigned long long)st->flows_closed,
+		(unsigned long long)st->flows_reset,
+		(unsigned long long)st->flows_timed_out,
+		(unsigned long long)st->flows_skipped);
+	verbose(level, "Stats: %llu bytes reassembled (%llu skipped), %llu"
+		" SSL records, %llu bursts, %llu req/res pairs (%llu"
+		" received), %u windows, %llu bytes waiting in the pipe\n",
+		(unsigned long long)st->bytes_reassembled,
+		(unsigned long long)st->bytes_skipped,
+		(unsigned long long)st->ssl_records,
+		(unsigned long long)cs->bursts,
+		(unsigned long long)cs->entries,
+		(unsigned long long)entries_received,
+		windows_analyzed, (unsigned long long)backlog);
+
+	if (stats_fn) write_stats_file(cs, backlog);
+}
 
-	verbose(0, "Lat: %lf, Lng: %lf\n", dlat, dlng);
+/* Adds a HTTP req/res pair to the window being collected. Offline the
+   window spans the oldest to the newest timestamp of its pairs, they
+   don't come in order as joined bursts keep the time of their start. */
+static void
+window_add(struct http_entry * hte, uint64_t * first_ts, uint64_t * last_ts)
+{
+	if (list_append(window_pairs, hte) < 0) fatal("Out of memory");
 
-	map_free(latmap, NULL);
-	map_free(lngmap, NULL);
-	list_free(retangles);
-	matches_free(matches);
+	if (live_mode) return;
+	if (!*first_ts || hte->ts < *first_ts) *first_ts = hte->ts;
+	if (hte->ts > *last_ts) *last_ts = hte->ts;
 }
 
 static void
 run_analyzer()
 {
 	char cmd;
-	time_t first_ts, last_ts;
-	struct list * list;
+	uint64_t first_ts, last_ts;
 	struct http_entry hte;
+	struct capture_stats cstats;
 	struct timeval tv;
+	time_t next_stats;
 	int ret, analyze_do, status, stop_after_analyze;
 	fd_set rfds;
 
-	tsmap = map_new(TSMAP_HASHSIZE);
+	window_pairs = list_new(sizeof(struct http_entry));
+	if (!window_pairs) fatal("Out of memory.");
 	first_ts = last_ts = stop_after_analyze = 0;
+	memset(&cstats, 0, sizeof(struct capture_stats));
+	next_stats = time(NULL) + stats_interval;
 
 	while (1) {
 
@@ -517,9 +496,16 @@ run_analyzer()
                    we really don't care and will just analyze after each passed
 		   timeframe based on the timestamps of the received bursts. */
 		if (live_mode) {
-			tv.tv_sec = 1;
-			tv.tv_usec = 0;
-			if (!first_ts) first_ts = time(NULL);
+			/* wake up at least once per window */
+			if (window_usec < 1000000) {
+				tv.tv_sec = 0;
+				tv.tv_usec = window_usec;
+			}
+			else {
+				tv.tv_sec = 1;
+				tv.tv_usec = 0;
+			}
+			if (!first_ts) first_ts = wallclock_usec();
 		}
 		else {
 			tv.tv_sec = 0;
@@ -531,11 +517,12 @@ run_analyzer()
 		}
 		while (ret < 0 && errno == EINTR);
 
-		if (child_died) {
+		/* offline the entries still in the pipe are read before
+		   the final analysis */
+		if (child_died && (live_mode || !FD_ISSET(capture_fd, &rfds))) {
 			/* child is done reading packets from PCAP file */
 			if (!live_mode) {
-				last_ts = first_ts + 2;
-				analyze_do = 1;
+				analyze_do = (list_count(window_pairs) > 0);
 				stop_after_analyze = 1;
 			}
 			else {
@@ -551,70 +538,155 @@ run_analyzer()
 			/* read new HTTP req/res pairs into the timestamp map */
 
 			read(capture_fd, &cmd, 1);
-			if (cmd == 'E') {
+			if (cmd == 'S') {
+				ret = read(capture_fd, &cstats,
+					sizeof(struct capture_stats));
+			}
+			else if (cmd == 'E') {
 				memset(&hte, 0, sizeof(struct http_entry));
 				ret = read(capture_fd, &hte,
 					sizeof(struct http_entry));
-			}	
-			else fatal("Invalid message from capture process");
-
-			verbose(3, "read new HTTP req/res pair: %u,%u\n",
-				hte.reqlen, hte.reslen);
+				hte.ts_recv = monotonic_ns();
 
-			list = map_get(tsmap, hte.ts);
-			if (!list) {
-				list = list_new(sizeof(struct http_entry));
-				if (!list) fatal("Out of memory.");
+				verbose(3, "read new HTTP req/res pair:"
+					" %u,%u\n", hte.reqlen, hte.reslen);
 
-				ret = map_set(tsmap, hte.ts, list);
-				if (ret < 0) fatal("Out of memory.");
-			}
-			ret = list_append(list, &hte);
-			if (ret < 0) fatal("Out of memory");
+				window_add(&hte, &first_ts, &last_ts);
+				entries_received++;
+			}	
+			else fatal("Invalid message from capture process");
+		}
 
-			if (!live_mode) {
-				if (!first_ts) first_ts = hte.ts;
-				last_ts = hte.ts;
-			}
+		if (stats_requested || (stats_interval &&
+				time(NULL) >= next_stats)) {
+			report_stats(0, &cstats, pipe_backlog(capture_fd));
+			stats_requested = 0;
+			next_stats = time(NULL) + stats_interval;
 		}
 
 		/* Determine if the timestamp interval exceeded the
 		   the limit and start analysis of the collection of
-		   requests in that interval. */
+		   requests in that interval. Live the windows go by the
+		   time the pairs are received. */
 		if (live_mode) {
-			last_ts = time(NULL);
-			if (last_ts - first_ts >= 2) {
+			last_ts = wallclock_usec();
+			if (last_ts >= first_ts + window_usec) {
 				analyze_do = 1;	
 			}
 		}
-		else if (last_ts - first_ts >= 2) {
+		else if (first_ts && last_ts >= first_ts + window_usec) {
 			analyze_do = 1;
 		}
 		if (analyze_do) {
 			analyze(first_ts, last_ts);
-			last_ts = first_ts = 0;
+			/* live windows follow each other without a gap */
+			first_ts = (live_mode ? last_ts : 0);
+			last_ts = 0;
 			analyze_do = 0;
-			if (stop_after_analyze) break;
 		}
+		if (stop_after_analyze) break;
 	}
 
 	wait(&status);
-	map_free(tsmap, _list_free);
+	list_free(window_pairs);
+	report_stats(1, &cstats, 0);
+	print_latencies(1);
+	print_zoom_stats();
+}
+
+static int
+flow_match(const struct flow_state * fs, const struct burst * b)
+{
+	return (fs->hash == b->hash && fs->chost == b->chost &&
+		fs->dhost == b->dhost && fs->cport == b->cport &&
+		fs->dport == b->dport);
 }
 
+/* Gets the state of the flow of a burst, creating it on its first
+   burst. */
+static struct flow_state *
+flow_get(const struct burst * b)
+{
+	struct flow_state * head, * fs;
+
+	if (!sessionmap) {
+		sessionmap = map_new(SESSIONMAP_HASHSIZE);
+		if (!sessionmap) {
+			fatal("Out of memory.");
+		}
+	}
+
+	head = map_get(sessionmap, (uint32_t)b->hash);
+	for (fs=head;fs;fs=fs->next) {
+		if (flow_match(fs, b)) return fs;
+	}
+
+	if (free_flows) {
+		fs = free_flows;
+		free_flows = fs->next;
+	}
+	else fs = xmalloc(sizeof(struct flow_state));
+
+	fs->hash = b->hash;
+	fs->chost = b->chost;
+	fs->dhost = b->dhost;
+	fs->cport = b->cport;
+	fs->dport = b->dport;
+	fs->pending = 0;
+	fs->reqlen = 0;
+	fs->next = head;
+	if (map_set(sessionmap, (uint32_t)b->hash, fs) < 0) {
+		fatal("Out of memory.");
+	}
+	return fs;
+}
+
+/* Lets go of the state of a flow libtrafficker is done with, it goes
+   back on the free list. */
 static void
-capture_callback(const struct burst * b)
-{ 
-	struct http_entry hte;
-	struct list * list;
-	struct burst bcmp;
-	uint32_t i, lc;
-	char cmd;
+flow_closed(const struct burst * b)
+{
+	struct flow_state * head, * fs, ** prev;
+
+	head = map_get(sessionmap, (uint32_t)b->hash);
+	for (prev=&head;(fs = *prev) != NULL;prev=&(fs->next)) {
+		if (flow_match(fs, b)) break;
+	}
+	if (!fs) return;
+
+	*prev = fs->next;
+	if (!head) map_del(sessionmap, (uint32_t)b->hash);
+	else if (map_set(sessionmap, (uint32_t)b->hash, head) < 0) {
+		fatal("Out of memory.");
+	}
+
+	fs->next = free_flows;
+	free_flows = fs;
+}
+
+static void
+_flows_free(void * p)
+{
+	struct flow_state * fs, * next;
+
+	for (fs=p;fs;fs=next) {
+		next = fs->next;
+		free(fs);
+	}
+}
+
+/* Pairs a burst with the request waiting in its flow, returns 1 and
+   fills in the entry if it makes a pair. */
+static int
+pair_burst(const struct burst * b, struct http_entry * hte)
+{
+	struct flow_state * fs;
 
 	verbose(3,
-		"burst: %s, len: %lu, incp: %i, "
+		"burst: %s, len: %lu, recs: %u, incp: %i, "
 		"(%i.%i.%i.%i:%i) - (%i.%i.%i.%i:%i)\n",
-		(b->client?"c->s":"s->c"), b->len, b->incomplete,
+		(b->client?"c->s":"s->c"), b->len, b->nr_records,
+		b->incomplete,
 		(b->chost >> 24) & 0xff,
 		(b->chost >> 16) & 0xff,
 		(b->chost >> 8) & 0xff,
@@ -626,58 +698,123 @@ capture_callback(const struct burst * b)
 		(b->dhost & 0xff),
 		htons(b->dport));
 
-	if (!sessionmap) {
-		sessionmap = map_new(SESSIONMAP_HASHSIZE);
-		if (!sessionmap) {
-			fatal("Out of memory.");
-		}
+	bursts_seen++;
+	if (record_log && burstlog_write(record_log, b) < 0)
+		fatal("Cannot write to burst log");
+
+	/* A client burst is the request waiting for a response, a server
+	   burst answers the last one of its flow and the pair is passed on
+	   to the analyzer. The request stays pending until the next client
+	   burst, as a response split on idle gaps (-g) comes in several
+	   server bursts which each make a pair. */
+	fs = flow_get(b);
+	if (b->client) {
+		fs->pending = 1;
+		fs->reqlen = b->len;
+		return 0;
 	}
+	if (!fs->pending) return 0;
+
+	hte->reqlen = fs->reqlen;
+	hte->reslen = b->len;
+	hte->ts = b->ts;
+	hte->ts_data = b->ts_data;
+	hte->ts_emit = b->ts_emit;
+	hte->ts_recv = 0;
+	PROBE4(gmaps, pair_matched, b->hash, hte->reqlen, hte->reslen,
+		hte->ts);
+
+	/* only flows with tile sized responses end up in the export */
+	if (export_fn && hte->reslen >= MIN_TILE_LEN &&
+			hte->reslen <= MAX_TILE_LEN)
+		trafficker_flow_keep(b->tr, b);
+
+	return 1;
+}
 
-	list = map_get(sessionmap, b->hash);
-	if (!list) {
-		list = list_new(sizeof(struct burst));
-		if (!list) {
-			fatal("Out of memory");
-		}
-		if (map_set(sessionmap, b->hash, list) < 0) {
-			fatal("Out of memory");
-		}
-	}
-	memcpy(&bcmp, b, sizeof(struct burst));
-	if (list_append(list, &bcmp) < 0) {
-		fatal("Out of memory");
-	}
+/* Sends the counters of the capture process to the analyzer in a single
+   write, so it doesn't mix up with the entries. */
+static void
+send_stats()
+{
+	char msg[1 + sizeof(struct capture_stats)];
+	struct capture_stats cs;
 
-	/* Check the lookup table if it is a server response and try to find
-	   the matching client request and pass these on. */
-	if (!b->client) {
-		lc = list_count(list);
-		for(i=lc-1;lc >= 1 && i>0;i--) {
-			if (list_get(list, i-1, &bcmp) < 0) {
-				fatal("Unexpected error in list_get");
-			}
-			if (bcmp.chost == b->chost &&
-				bcmp.dhost == b->dhost &&
-				bcmp.cport == b->cport &&
-				bcmp.dport == b->dport &&
-				bcmp.client && bcmp.hash == b->hash) {
+	memset(&cs, 0, sizeof(struct capture_stats));
+	if (tr) trafficker_get_stats(tr, &(cs.tr));
+	cs.bursts = bursts_seen;
+	cs.entries = entries_sent;
 
-				if (live_mode) hte.ts = time(NULL);
+	msg[0] = 'S';
+	memcpy(msg + 1, &cs, sizeof(struct capture_stats));
+	write(analyze_fd, msg, sizeof(msg));
+}
 
-				hte.reqlen = bcmp.len;
-				hte.reslen = b->len;
-				hte.ts = b->ts;
+static void
+signal_alarm(int sig)
+{
+	stats_due = 1;
+}
 
-				cmd = 'E';
-				write(analyze_fd, &cmd, 1);
-				write(analyze_fd, &hte,
-					sizeof(struct http_entry));
+/* Sends the counters once the timer asked for them. It is checked as
+   the bursts are handled, not in the signal handler, as the counters
+   are updated while the packets are read. */
+static void
+check_stats()
+{
+	if (!stats_due) return;
+	stats_due = 0;
+	send_stats();
+}
 
-				/* XXX: remove the entries from the list */
-				break;
-			}
+static void
+capture_callback(const struct burst * b)
+{
+	struct http_entry hte;
+	char msg[1 + sizeof(struct http_entry)];
+
+	check_stats();
+	if (b->closed) {
+		flow_closed(b);
+		return;
+	}
+	if (!pair_burst(b, &hte)) return;
+
+	/* a single write keeps the message in one piece */
+	msg[0] = 'E';
+	memcpy(msg + 1, &hte, sizeof(struct http_entry));
+	write(analyze_fd, msg, sizeof(msg));
+	entries_sent++;
+}
+
+_Static_assert(CAPTURE_BATCH * (1 + sizeof(struct http_entry)) <= PIPE_BUF,
+	"a batch of pairs has to fit in a single write of PIPE_BUF bytes");
+
+/* Handles a batch from libtrafficker, the pairs of the whole batch go
+   to the analyzer in a single write. There are no more pairs than
+   bursts, so it stays within PIPE_BUF. */
+static void
+capture_batch(const struct burst * bursts, size_t n)
+{
+	char msg[CAPTURE_BATCH * (1 + sizeof(struct http_entry))];
+	struct http_entry hte;
+	size_t i, len;
+
+	len = 0;
+	for (i=0;i<n;i++) {
+		if (bursts[i].closed) {
+			flow_closed(&(bursts[i]));
+			continue;
 		}
+		if (!pair_burst(&(bursts[i]), &hte)) continue;
+		msg[len] = 'E';
+		memcpy(msg + len + 1, &hte, sizeof(struct http_entry));
+		len += 1 + sizeof(struct http_entry);
+		entries_sent++;
 	}
+
+	if (len) write(analyze_fd, msg, len);
+	check_stats();
 }
 
 static void
@@ -693,10 +830,89 @@ signal_int(int sig)
 	int_received = 1;
 }
 
+static void
+signal_usr1(int sig)
+{
+	stats_requested = 1;
+}
+
 static void
 signal_pipe(int sig)
 {
-	trafficker_breakloop(tr);
+	if (tr) trafficker_breakloop(tr);
+	replay_stop = 1;
+}
+
+/* Feeds the bursts of a burst log to the request/response pairing just
+   like libtrafficker would. */
+static void
+replay_bursts(const char * fname)
+{
+	struct burstlog * l;
+	struct burst b;
+	int ret = 0;
+
+	l = burstlog_open(fname);
+	if (!l) {
+		warning("Cannot open burst log %s\n", fname);
+		exit(EXIT_FAILURE);
+	}
+	if (replay_to && burstlog_set_range(l, replay_from, replay_to) < 0)
+		fatal("Invalid replay time range");
+
+	while (!replay_stop && (ret = burstlog_read(l, &b)) > 0) {
+		b.ts_data = b.ts_emit = monotonic_ns();
+		capture_callback(&b);
+	}
+	if (ret < 0) warning("Burst log %s is corrupt\n", fname);
+
+	burstlog_close(l);
+}
+
+/* Everything the capture process does between being forked and exiting:
+   capturing or replaying the bursts, optionally recording them. */
+static void
+capture_main(const char * fname, const char * logname)
+{
+	struct itimerval it;
+
+	signal(SIGPIPE, signal_pipe);
+	signal(SIGUSR1, SIG_IGN);
+
+	/* the analyzer gets the counters every STATS_UPDATE_INTERVAL with
+	   the next bursts, and once more at the end */
+	memset(&it, 0, sizeof(struct itimerval));
+	it.it_interval.tv_sec = STATS_UPDATE_INTERVAL;
+	it.it_value.tv_sec = STATS_UPDATE_INTERVAL;
+	signal(SIGALRM, signal_alarm);
+	setitimer(ITIMER_REAL, &it, NULL);
+
+	if (logname) {
+		record_log = burstlog_create(logname);
+		if (!record_log) {
+			warning("Cannot create burst log %s\n", logname);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (replay_mode) replay_bursts(fname);
+	else if (trafficker_loop_batch(tr, capture_batch, CAPTURE_BATCH,
+			CAPTURE_BATCH_USEC) < 0)
+		fatal("Out of memory.");
+
+	memset(&it, 0, sizeof(struct itimerval));
+	setitimer(ITIMER_REAL, &it, NULL);
+	signal(SIGALRM, SIG_IGN);
+	send_stats();
+
+	trafficker_close(tr);
+	tr = NULL;
+
+	burstlog_close(record_log);
+	if (sessionmap) map_free(sessionmap, _flows_free);
+	_flows_free(free_flows);
+	profile_unload(profile);
+	exit(EXIT_SUCCESS);
 }
 
 static int
@@ -705,7 +921,7 @@ run_capture_child(struct trafficker * tr)
 	int pipefd[2], ret;
 	pid_t pid;
 
-	if (!tr) return -1;
+	if (!tr && !replay_mode) return -1;
 
 	ret = pipe(pipefd);
 	if (ret < 0) return -1;
@@ -717,16 +933,378 @@ run_capture_child(struct trafficker * tr)
 	}
 
 	analyze_fd = pipefd[1];
-	signal(SIGPIPE, signal_pipe);
-	trafficker_loop(tr, capture_callback);
-	trafficker_close(tr);
-	map_free(sessionmap, _list_free);
-	profile_unload(profilemap);
-	exit(EXIT_SUCCESS);
+	capture_main(capture_files ? capture_files[0] : NULL, record_fn);
+	return -1; /* not reached */
+}
+
+/* Passes the server prefixes on to libtrafficker, which only follows the
+   flows to and from them. */
+static void
+add_servers(struct trafficker * t)
+{
+	struct server_prefix sp;
+	uint32_t i;
+
+	for (i=0;i<list_count(servers);i++) {
+		list_get(servers, i, &sp);
+		if (trafficker_add_server(t, sp.addr, sp.len) < 0)
+			fatal("Cannot add the server prefixes");
+	}
+}
+
+/* Forks a capture process for capture file idx. The sessions still open
+   at the end of the file are followed into the next files, sessions
+   which started in an earlier file are ignored by libnids since it
+   never saw their handshake. */
+static void
+run_file_worker(struct worker * w, uint32_t idx, const char * filter)
+{
+	char * logname, * exportname;
+	int pipefd[2];
+	uint32_t i;
+	pid_t pid;
+
+	if (pipe(pipefd) < 0) fatal("Cannot create pipe");
+
+	pid = fork();
+	if (pid == -1) fatal("Cannot fork capture process");
+	if (pid) {
+		close(pipefd[1]);
+		w->pid = pid;
+		w->fd = pipefd[0];
+		return;
+	}
+
+	close(pipefd[0]);
+	if (!replay_mode) {
+		tr = trafficker_open_offline(capture_files[idx], filter);
+		if (!tr) {
+			warning("Error while opening pcap file %s\n",
+				capture_files[idx]);
+			exit(EXIT_FAILURE);
+		}
+		for (i=idx+1;i<nr_capture_files;i++) {
+			if (trafficker_add_tail(tr, capture_files[i]) < 0)
+				break;
+		}
+		add_servers(tr);
+		trafficker_set_burstjoin(tr, 1);
+		trafficker_set_burstgap(tr, burst_gap);
+	}
+
+	verbose(2, "Reading %s\n", capture_files[idx]);
+
+	/* every capture process records its own burst log and export */
+	logname = NULL;
+	if (record_fn) {
+		logname = xmalloc(strlen(record_fn) + 12);
+		sprintf(logname, "%s.%04u", record_fn, idx);
+	}
+	if (export_fn) {
+		exportname = xmalloc(strlen(export_fn) + 12);
+		sprintf(exportname, "%s.%04u", export_fn, idx);
+		if (trafficker_set_export(tr, exportname) < 0) {
+			warning("Cannot create export %s\n", exportname);
+			exit(EXIT_FAILURE);
+		}
+		free(exportname);
+	}
+
+	analyze_fd = pipefd[1];
+	capture_main(capture_files[idx], logname);
+}
+
+/* Reads what is available from a capture process, queues the entries
+   and keeps its latest counters. */
+static void
+worker_read(struct worker * w)
+{
+	struct http_entry * queue, hte;
+	size_t msglen, off;
+	uint32_t i;
+	ssize_t ret;
+
+	ret = read(w->fd, w->buf + w->buflen, sizeof(w->buf) - w->buflen);
+	if (ret < 0 && errno == EINTR) return;
+	if (ret <= 0) {
+		close(w->fd);
+		waitpid(w->pid, NULL, 0);
+		w->fd = -1;
+		w->done = 1;
+		return;
+	}
+	w->buflen += ret;
+
+	for (off=0;off<w->buflen;off+=msglen) {
+		if (w->buf[off] == 'S') {
+			msglen = 1 + sizeof(struct capture_stats);
+			if (off + msglen > w->buflen) break;
+			memcpy(&(w->stats), w->buf + off + 1,
+				sizeof(struct capture_stats));
+			continue;
+		}
+		if (w->buf[off] != 'E')
+			fatal("Invalid message from capture process");
+		msglen = 1 + sizeof(struct http_entry);
+		if (off + msglen > w->buflen) break;
+
+		if (w->head + w->count == w->alloc) {
+			if (w->head) {
+				memmove(w->queue, w->queue + w->head,
+					sizeof(struct http_entry) * w->count);
+				w->head = 0;
+			}
+			if (w->count == w->alloc) {
+				w->alloc = (w->alloc ? w->alloc * 2 : 256);
+				queue = realloc(w->queue,
+					sizeof(struct http_entry) * w->alloc);
+				if (!queue) fatal("Out of memory.");
+				w->queue = queue;
+			}
+		}
+		memcpy(&hte, w->buf + off + 1, sizeof(struct http_entry));
+		hte.ts_recv = monotonic_ns();
+		if (hte.ts > w->newest) w->newest = hte.ts;
+
+		/* the entries mostly come in order, the newer queued ones
+		   are moved up to keep the queue sorted */
+		for (i=w->head+w->count;i>w->head;i--) {
+			if (w->queue[i - 1].ts <= hte.ts) break;
+			memcpy(&(w->queue[i]), &(w->queue[i - 1]),
+				sizeof(struct http_entry));
+		}
+		memcpy(&(w->queue[i]), &hte, sizeof(struct http_entry));
+		w->count++;
+	}
+	memmove(w->buf, w->buf + off, w->buflen - off);
+	w->buflen -= off;
 }
 
+/* Returns the index of the worker with the oldest queued entry, -1 if
+   it has to wait for more entries and -2 if all workers are done. A
+   capture process sends its entries in the order their bursts complete,
+   so an entry still to come can be older than the queued ones. Nothing
+   is merged while a running worker has no entries queued, and an entry
+   is only merged once it is MERGE_HOLD_SEC older than what every running
+   worker has sent so far. That bounds what is held back, entries out of
+   order by more than that are merged late. The files not started yet
+   hold back the merge as well. Ties go to the earlier file. */
+static int
+worker_next(struct worker * workers, uint32_t nr_workers)
+{
+	struct worker * w;
+	uint64_t newest = 0;
+	int next = -1, waiting = 0, running = 0;
+	uint32_t i;
+
+	for (i=0;i<nr_workers;i++) {
+		w = &(workers[i]);
+		if (!w->done) waiting = 1;
+		if (w->fd >= 0) {
+			if (!w->count) return -1;
+			if (!running || w->newest < newest)
+				newest = w->newest;
+			running = 1;
+		}
+		if (!w->count) continue;
+		if (next < 0 || w->queue[w->head].ts <
+				workers[next].queue[workers[next].head].ts)
+			next = i;
+	}
+
+	if (!waiting) return (next < 0 ? -2 : next);
+	if (next < 0 || !running) return -1;
+	w = &(workers[next]);
+	if (w->queue[w->head].ts + MERGE_HOLD_SEC * 1000000ULL > newest)
+		return -1;
+	return next;
+}
+
+/* Offline analysis of several capture files. Up to nr_jobs files are
+   read at the same time by separate capture processes and their entries
+   are merged by timestamp, within the hold back of worker_next(), before
+   they go into the analysis windows. */
 static void
-resolve_host(struct map * ipmap, const char * host)
+run_merger(const char * filter, uint32_t nr_jobs)
+{
+	struct worker * workers, * w;
+	struct http_entry hte;
+	struct capture_stats cstats;
+	struct timeval tv;
+	uint64_t first_ts, last_ts;
+	time_t next_stats;
+	uint32_t started, running, i;
+	uint64_t backlog;
+	int maxfd, ret, next;
+	fd_set rfds;
+
+	window_pairs = list_new(sizeof(struct http_entry));
+	if (!window_pairs) fatal("Out of memory.");
+	workers = xmalloc(sizeof(struct worker) * nr_capture_files);
+	for (i=0;i<nr_capture_files;i++) workers[i].fd = -1;
+	next_stats = time(NULL) + stats_interval;
+
+	first_ts = last_ts = 0;
+	started = running = 0;
+	while (!int_received) {
+		while (running < nr_jobs && started < nr_capture_files) {
+			run_file_worker(&(workers[started]), started, filter);
+			started++;
+			running++;
+		}
+
+		while ((next = worker_next(workers, nr_capture_files)) >= 0) {
+			w = &(workers[next]);
+			memcpy(&hte, &(w->queue[w->head]),
+				sizeof(struct http_entry));
+			w->head++;
+			w->count--;
+
+			verbose(3, "read new HTTP req/res pair: %u,%u\n",
+				hte.reqlen, hte.reslen);
+
+			window_add(&hte, &first_ts, &last_ts);
+			entries_received++;
+			if (last_ts >= first_ts + window_usec) {
+				analyze(first_ts, last_ts);
+				last_ts = first_ts = 0;
+			}
+		}
+		if (next == -2) break;
+
+		if (stats_requested || (stats_interval &&
+				time(NULL) >= next_stats)) {
+			memset(&cstats, 0, sizeof(struct capture_stats));
+			backlog = 0;
+			for (i=0;i<started;i++) {
+				stats_add(&cstats, &(workers[i].stats));
+				backlog += pipe_backlog(workers[i].fd);
+			}
+			report_stats(0, &cstats, backlog);
+			stats_requested = 0;
+			next_stats = time(NULL) + stats_interval;
+		}
+
+		FD_ZERO(&rfds);
+		maxfd = -1;
+		for (i=0;i<started;i++) {
+			if (workers[i].fd < 0) continue;
+			FD_SET(workers[i].fd, &rfds);
+			if (workers[i].fd > maxfd) maxfd = workers[i].fd;
+		}
+		if (maxfd < 0) continue;
+
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		ret = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			fatal("select() failed");
+		}
+
+		for (i=0;i<started;i++) {
+			w = &(workers[i]);
+			if (w->fd < 0 || !FD_ISSET(w->fd, &rfds)) continue;
+			worker_read(w);
+			if (w->done) running--;
+		}
+	}
+
+	if (int_received) {
+		warning("SIGINT received. Exitting.\n");
+		for (i=0;i<started;i++) {
+			if (workers[i].fd < 0) continue;
+			kill(workers[i].pid, SIGTERM);
+			close(workers[i].fd);
+			waitpid(workers[i].pid, NULL, 0);
+		}
+	}
+	else if (list_count(window_pairs)) analyze(first_ts, last_ts);
+
+	memset(&cstats, 0, sizeof(struct capture_stats));
+	for (i=0;i<started;i++) stats_add(&cstats, &(workers[i].stats));
+	report_stats(1, &cstats, 0);
+	print_latencies(1);
+
+	for (i=0;i<nr_capture_files;i++) free(workers[i].queue);
+	free(workers);
+	list_free(window_pairs);
+	print_zoom_stats();
+}
+
+static int
+compare_names(const void * a, const void * b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void
+add_capture_file(const char * fname)
+{
+	char ** files;
+
+	files = realloc(capture_files,
+		sizeof(char *) * (nr_capture_files + 1));
+	if (!files) fatal("Out of memory.");
+	capture_files = files;
+	capture_files[nr_capture_files] = strdup(fname);
+	if (!capture_files[nr_capture_files]) fatal("Out of memory.");
+	nr_capture_files++;
+}
+
+/* Collects the capture files to read from a single filename, a
+   directory or a glob pattern. The files of a directory are read in the
+   order of their names, just like the ones matching a pattern. */
+static void
+find_capture_files(const char * arg)
+{
+	struct stat st;
+	struct dirent * de;
+	glob_t g;
+	DIR * dir;
+	char * path;
+	size_t i;
+
+	if (!stat(arg, &st) && S_ISDIR(st.st_mode)) {
+		dir = opendir(arg);
+		if (!dir) fatal("Cannot open capture directory");
+		while ((de = readdir(dir))) {
+			if (de->d_name[0] == '.') continue;
+			path = xmalloc(strlen(arg) + strlen(de->d_name) + 2);
+			sprintf(path, "%s/%s", arg, de->d_name);
+			if (!stat(path, &st) && S_ISREG(st.st_mode))
+				add_capture_file(path);
+			free(path);
+		}
+		closedir(dir);
+		if (nr_capture_files)
+			qsort(capture_files, nr_capture_files,
+				sizeof(char *), compare_names);
+	}
+	else if (strpbrk(arg, "*?[")) {
+		if (!glob(arg, 0, NULL, &g)) {
+			for (i=0;i<g.gl_pathc;i++)
+				add_capture_file(g.gl_pathv[i]);
+		}
+		globfree(&g);
+	}
+	else add_capture_file(arg);
+
+	if (!nr_capture_files) fatal("No capture files found");
+}
+
+static void
+server_add(uint32_t addr, uint32_t len)
+{
+	struct server_prefix sp;
+
+	sp.addr = addr;
+	sp.len = len;
+	if (list_append(servers, &sp) < 0) fatal("Out of memory.");
+}
+
+static void
+resolve_host(const char * host)
 {
 	struct in_addr in;
 	struct addrinfo * result, * ai;
@@ -749,23 +1327,140 @@ resolve_host(struct map * ipmap, const char * host)
 		ip = ((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr;
 		in.s_addr = ip;
 		verbose(3, "Host %s resolves to %s\n", host, inet_ntoa(in));
+		server_add(ntohl(ip), 32);
 	}
 
 	freeaddrinfo(result);
 }
 
+/* Parses a list of zoom levels and zoom level ranges like "2,4-6" into
+   a bitmask of zoom levels. */
+static uint32_t
+parse_zooms(const char * arg)
+{
+	uint32_t mask = 0;
+	unsigned int from, to, z;
+	int n;
+
+	while (*arg) {
+		if (sscanf(arg, "%u-%u%n", &from, &to, &n) != 2) {
+			if (sscanf(arg, "%u%n", &from, &n) != 1)
+				fatal("Invalid zoom level list");
+			to = from;
+		}
+		if (from > to || to >= MAX_Z)
+			fatal("Invalid zoom level list");
+		for (z=from;z<=to;z++)
+			mask |= (1 << z);
+		arg += n;
+		if (*arg == ',') arg++;
+		else if (*arg) fatal("Invalid zoom level list");
+	}
+
+	return mask;
+}
+
+/* Gets the prefixes of the Google Maps servers, either from the
+   specified list of addresses and CIDR prefixes, one per line, or by
+   resolving the DNS entries of the Google Maps servers. The capture
+   filter doesn't depend on them, libtrafficker matches the flows
+   against all of them at once. */
+static void
+load_servers(const char * iplistfn)
+{
+	FILE * f;
+	char buf[128], * p, * slash, * end;
+	struct in_addr in;
+	unsigned long len;
+
+	servers = list_new(sizeof(struct server_prefix));
+	if (!servers) fatal("Out of memory.");
+
+	if (!iplistfn) {
+		verbose(2, "No IPv4 list specified, start DNS resolving\n");
+		resolve_host("khms0.google.com");
+		resolve_host("khms1.google.com");
+		resolve_host("khms2.google.com");
+		resolve_host("khms3.google.com");
+	}
+	else {
+		verbose(2, "Parsing the supplied list of IPv4 addresses\n");
+		f = fopen(iplistfn, "r");
+		if (!f) fatal("Cannot open file with IPv4 addresses");
+		while (fgets(buf, sizeof(buf), f)) {
+			p = buf + strspn(buf, " \t");
+			p[strcspn(p, " \t\r\n#")] = 0;
+			if (!*p) continue;
+
+			len = 32;
+			slash = strchr(p, '/');
+			if (slash) {
+				*slash = 0;
+				len = strtoul(slash + 1, &end, 10);
+				if (end == slash + 1 || *end || len > 32)
+					fatal("Invalid prefix length in the"
+						" list of IPv4 addresses");
+			}
+			if (!inet_aton(p, &in))
+				fatal("Error while parsing file. Only supports"
+					" one IP address or prefix per line");
+			server_add(ntohl(in.s_addr), len);
+			verbose(3, "Matching flows of %s/%lu\n", p, len);
+		}
+		fclose(f);
+	}
+
+	if (!list_count(servers))
+		fatal("No hosts specified to use for the filter");
+}
+
 static void
 usage(const char * arg0)
 {
-	fprintf(stderr, "%s -L/-O <arg> [options]\n", arg0);
+	fprintf(stderr, "%s -L/-O/-R <arg> [options]\n", arg0);
 	fprintf(stderr, "Do gmaps traffic analysis on a");
 	fprintf(stderr, " live pcap session or an offline session.\n\n");
 	fprintf(stderr, "-L <device>    - live device to capture on\n");
-	fprintf(stderr, "-O <filename>  - offline pcap file to read from\n\n");
+	fprintf(stderr, "-O <filename>  - offline pcap file to read from\n");
+	fprintf(stderr, "                 (or a directory or pattern of");
+	fprintf(stderr, " consecutive files)\n");
+	fprintf(stderr, "-R <burstlog>  - replay a burst log instead of");
+	fprintf(stderr, " capturing\n");
+	fprintf(stderr, "                 (or a directory or pattern of");
+	fprintf(stderr, " burst logs)\n");
+	fprintf(stderr, "-j <jobs>      - number of offline files to read");
+	fprintf(stderr, " at the same time\n");
+	fprintf(stderr, "-g <ms>        - also split the bursts of a flow");
+	fprintf(stderr, " after this long without data\n");
+	fprintf(stderr, "                 (default: off, for keep-alive");
+	fprintf(stderr, " connections fetching tiles back to back)\n");
+	fprintf(stderr, "-W <ms>        - length of the analysis windows");
+	fprintf(stderr, " (default: %u)\n\n", ANALYZE_WINDOW_MS);
+	fprintf(stderr, "-w <burstlog>  - record all bursts to this burst");
+	fprintf(stderr, " log\n");
+	fprintf(stderr, "                 (with several files one log per");
+	fprintf(stderr, " file, suffixed .0000, .0001, ...)\n");
+	fprintf(stderr, "-e <pcapfile>  - write the packets of flows with");
+	fprintf(stderr, " tile sized responses to this file\n");
+	fprintf(stderr, "                 (with several files one per");
+	fprintf(stderr, " file, suffixed .0000, .0001, ...)\n");
+	fprintf(stderr, "-t <from>[-to] - only replay the bursts within");
+	fprintf(stderr, " this time range (unix time)\n");
+	fprintf(stderr, "-S <seconds>   - print statistics this often");
+	fprintf(stderr, " (default: %u, 0 for never)\n", STATS_INTERVAL);
+	fprintf(stderr, "                 (and on SIGUSR1)\n");
+	fprintf(stderr, "-s <file>      - also write the statistics to");
+	fprintf(stderr, " this file\n");
 	fprintf(stderr, "-f <profile>   - profile datafile");
 	fprintf(stderr, " (default: ./%s)\n", DEFAULT_FN);
+	fprintf(stderr, "                 (use multiple times to match");
+	fprintf(stderr, " several regions at once)\n");
+	fprintf(stderr, "-z <zooms>     - only load and match these zoom");
+	fprintf(stderr, " levels (e.g. 2-5,8)\n");
 	fprintf(stderr, "-i <iplist>    - text file with IPv4 addresses of");
 	fprintf(stderr, " the gmap servers.\n");
+	fprintf(stderr, "                 (or prefixes like");
+	fprintf(stderr, " 74.125.0.0/16)\n");
 	fprintf(stderr, "-u <user>      - privdrop to this user\n");
 	fprintf(stderr, "-c             - colorize output\n");
 	fprintf(stderr, "-v             - be verbose (use multiple times");
@@ -776,19 +1471,18 @@ usage(const char * arg0)
 int
 main(int argc, char ** argv, char ** envp)
 {
-	FILE * f;
-	char buf[128];
-	struct map * ipmap;
-	struct list * keys;
-	struct in_addr in;
-	uint32_t keycount, i;
+	uint32_t i, nr_jobs;
 	const char * arg0 = NULL, * iplistfn = NULL;
-	char * live = NULL, * offline = NULL, * user = NULL, * filter;
-	char * profile = DEFAULT_FN;
+	char * live = NULL, * offline = NULL, * user = NULL;
+	const char * filter = NULL;
+	long from, to;
 	int c, ret;
+	long n;
 
+	nr_jobs = 0;
 	arg0 = (argc > 0 ? argv[0] : "(unknown)");
-	while ((c = getopt(argc, argv, "hL:O:f:u:vi:c")) != -1) {
+	while ((c = getopt(argc, argv,
+			"hL:O:R:f:u:vi:cz:j:g:W:w:e:t:S:s:")) != -1) {
 		switch (c) {
 			case 'c':
 				colorize_output = 1;
@@ -807,21 +1501,71 @@ main(int argc, char ** argv, char ** envp)
 			case 'O':
 				offline = optarg;
 				live_mode = 0;
+				replay_mode = 0;
+				break;
+			case 'R':
+				offline = optarg;
+				live_mode = 0;
+				replay_mode = 1;
+				break;
+			case 'w':
+				record_fn = optarg;
+				break;
+			case 'e':
+				export_fn = optarg;
+				break;
+			case 'S':
+				n = atoi(optarg);
+				if (n < 0) fatal("Invalid statistics interval");
+				stats_interval = n;
+				break;
+			case 's':
+				stats_fn = optarg;
+				break;
+			case 't':
+				ret = sscanf(optarg, "%ld-%ld", &from, &to);
+				if (ret == 1) to = LONG_MAX;
+				if (ret < 1 || from < 0 || from > to)
+					fatal("Invalid replay time range");
+				replay_from = from;
+				replay_to = to;
 				break;
 			case 'i':
 				iplistfn = optarg;
 				break;
 			case 'f':
-				profile = optarg;
+				if (nr_regions == MAX_REGIONS)
+					fatal("Too many profiles specified");
+				region_names[nr_regions++] = optarg;
 				break;
 			case 'u':
 				user = optarg;
 				break;
+			case 'z':
+				zoom_mask = parse_zooms(optarg);
+				break;
+			case 'j':
+				n = atoi(optarg);
+				if (n < 1) fatal("Invalid number of jobs");
+				nr_jobs = n;
+				break;
+			case 'g':
+				n = atoi(optarg);
+				if (n < 0 || n > 3600 * 1000)
+					fatal("Invalid burst gap");
+				burst_gap = n * 1000;
+				break;
+			case 'W':
+				n = atoi(optarg);
+				if (n < 1 || n > 3600 * 1000)
+					fatal("Invalid analysis window");
+				window_usec = n * 1000ULL;
+				break;
 		}
 	}
 
 	if (live && offline) {
-		fprintf(stderr, "Cannot use -L and -O at the same time.");
+		fprintf(stderr, "Cannot use -L and -O/-R at the same time.");
 		fprintf(stderr, " Use -h for info.\n");
 		exit(EXIT_FAILURE);
 	}
@@ -830,95 +1574,108 @@ main(int argc, char ** argv, char ** envp)
 		fprintf(stderr, " Use -h for info.\n");
 		exit(EXIT_FAILURE);
 	}
-
-	profilemap = profile_load(profile);
-	if (!profilemap) {
-		fprintf(stderr, "Cannot load profile.\n");
+	else if (replay_to && !replay_mode) {
+		fprintf(stderr, "A time range can only be used with -R.");
+		fprintf(stderr, " Use -h for info.\n");
+		exit(EXIT_FAILURE);
+	}
+	else if (export_fn && replay_mode) {
+		fprintf(stderr, "A burst log has no packets to export.");
+		fprintf(stderr, " Use -h for info.\n");
 		exit(EXIT_FAILURE);
 	}
 
-	/* Construct the PCAP filter: first get the list of available IP's
-	   to filter on either by getting the specified list of IP's or by
-	   doing resolving DNS entries for the Google Maps servers. Then built
-	   the filter based on this map. */
-
-	ipmap = map_new(1009);
-	if (!iplistfn) {
-		verbose(2, "No IPv4 list specified, start DNS resolving\n");
-		resolve_host(ipmap, "khms0.google.com");
-		resolve_host(ipmap, "khms1.google.com");
-		resolve_host(ipmap, "khms2.google.com");
-		resolve_host(ipmap, "khms3.google.com");
+	/* load all profiles into one combined profile, the entries get
+	   tagged with the region they belong to */
+	if (!nr_regions) region_names[nr_regions++] = DEFAULT_FN;
+	profile = profile_new();
+	if (!profile) fatal("Out of memory.");
+	profile_set_zooms(profile, zoom_mask);
+	for (i=0;i<nr_regions;i++) {
+		if (profile_add_file(profile, region_names[i], i) < 0) {
+			fprintf(stderr, "Cannot load profile %s.\n",
+				region_names[i]);
+			exit(EXIT_FAILURE);
+		}
 	}
-	else {
-		verbose(2, "Parsing the supplied list of IPv4 addresses\n");
-		f = fopen(iplistfn, "r");
-		if (!f) fatal("Cannot open file with IPv4 addresses");
-		do {
-			memset(buf, 0, sizeof(buf));
-			fgets(buf, sizeof(buf)-1, f);
-			if (!strlen(buf)) break;
-			ret = inet_aton(buf, &in);
-			map_set(ipmap, in.s_addr, NULL);
-		} while (ret > 0 && !feof(f));
-		fclose(f);
-		if (!ret)
-			fatal("Error while parsing file. Only supportes one "
-			"IP address per line");
+
+	/* a replay doesn't need a filter, the bursts were already
+	   filtered when they got recorded */
+	if (!replay_mode) {
+		load_servers(iplistfn);
+		filter = CAPTURE_FILTER;
+		verbose(3, "Using PCAP filter of '%s' and %u server"
+			" prefixes\n", filter, list_count(servers));
 	}
-	keys = map_getkeys(ipmap, 0);
-	keycount = list_count(keys);
-	if (!keycount) fatal("No hosts specified to use for the filter");
 
-	filter = xmalloc((15 + strlen(" or host ")) * keycount +
-		strlen(") and port 443"));
+	/* several capture files are read by parallel capture processes */
+	if (offline) find_capture_files(offline);
+	if (nr_capture_files > 1) {
+		if (!nr_jobs) {
+			n = sysconf(_SC_NPROCESSORS_ONLN);
+			nr_jobs = (n > 0 ? n : 1);
+		}
+		verbose(1, "Reading %u capture files with %u jobs\n",
+			nr_capture_files, nr_jobs);
 
-	list_get(keys, 0, &(in.s_addr));
-	strcat(filter, "(host ");
-	strcat(filter, inet_ntoa(in));
-	for(i=1;i<keycount;i++) {
-		list_get(keys, i, &(in.s_addr));
-		strcat(filter, " or host ");
-		strcat(filter, inet_ntoa(in));
-	}
-	strcat(filter, ") and port 443");
-	list_free(keys);	
-	map_free(ipmap, NULL);
+		if (user) privdrop(user);
+		signal(SIGINT, signal_int);
+		signal(SIGUSR1, signal_usr1);
 
-	verbose(3, "Using PCAP filter of '%s'\n", filter);
+		run_merger(filter, nr_jobs);
+
+		if (servers) list_free(servers);
+		for (i=0;i<nr_capture_files;i++) free(capture_files[i]);
+		free(capture_files);
+		profile_unload(profile);
+		exit(EXIT_SUCCESS);
+	}
 
 	/* open the libtrafficker session with the built up filter */
 	if (live) tr = trafficker_open_online(live, filter);
-	else tr = trafficker_open_offline(offline, filter);
-	if (!tr) {
+	else if (!replay_mode)
+		tr = trafficker_open_offline(capture_files[0], filter);
+	if (!tr && !replay_mode) {
 		fprintf(stderr, "Error while opening pcap file/stream!\n");
 		exit(EXIT_FAILURE);
 	}
-	free(filter);
+	if (!replay_mode) {
+		add_servers(tr);
+		list_free(servers);
+	}
+
+	if (export_fn && trafficker_set_export(tr, export_fn) < 0) {
+		fprintf(stderr, "Cannot create export %s.\n", export_fn);
+		exit(EXIT_FAILURE);
+	}
 
 	/* privdrop if requested */
 	if (user) privdrop(user);
 
 	/* join individual bursts until a data direction switch occurs. */
 	trafficker_set_burstjoin(tr, 1);
+	trafficker_set_burstgap(tr, burst_gap);
 
 	/* run the capturing child process */
 	capture_fd = run_capture_child(tr);
 	if (capture_fd < 0) {
 		trafficker_close(tr);
-		profile_unload(profilemap);
+		profile_unload(profile);
 		fprintf(stderr, "Cannot open capture child.\n");
 		exit(EXIT_FAILURE);
 	}
 
 	signal(SIGCHLD, signal_child);
 	signal(SIGINT, signal_int);
+	signal(SIGUSR1, signal_usr1);
 
 	run_analyzer();
 
 	/* cleanup */
 	trafficker_close(tr); /* XXX: move tr ref only to capture */
-	profile_unload(profilemap);
+	profile_unload(profile);
+	for (i=0;i<nr_capture_files;i++) free(capture_files[i]);
+	free(capture_files);
 
 	exit(EXIT_SUCCESS);
 }
@@ -1,29 +1,296 @@
 /* gmaps-utils.c */
 
+#include <arpa/inet.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "gmaps.h"
 
-struct map *
-profile_load(const char * fn)
+/* contents of one encoded profile file */
+struct profile_source {
+	unsigned char * blob;
+	size_t bloblen;
+	uint8_t id;
+};
+
+/* (size, zoom) group which hasn't been decoded yet */
+struct profile_group {
+	uint32_t off;
+	uint32_t src;
+};
+
+/* In-memory profile. Raw profiles are decoded into the sizes map when
+   loaded, encoded profiles keep the file contents around as a source and
+   only get decoded for one size bucket at a time when that bucket is
+   first asked for through profile_get(). Several profile files can be
+   combined in one profile, their entries are then tagged with the id of
+   the file they came from. */
+struct profile {
+	struct map * sizes;
+	struct map * groups;
+	struct profile_source sources[MAX_REGIONS];
+	uint32_t nr_sources;
+	uint32_t zmask;
+};
+
+static int
+profile_entry_compare(const void * a, const void * b)
 {
-	uint8_t z;
-	uint16_t sz;
-	uint32_t i, j, x, y, nr_entries;
+	const struct profile_entry * pa = a, * pb = b;
+
+	if (pa->z != pb->z) return (pa->z < pb->z ? -1 : 1);
+	if (pa->x != pb->x) return (pa->x < pb->x ? -1 : 1);
+	if (pa->y != pb->y) return (pa->y < pb->y ? -1 : 1);
+	return 0;
+}
+
+static size_t
+varint_put(unsigned char * p, uint32_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/* Returns the number of bytes consumed or 0 if the varint is truncated
+   or doesn't fit in 32 bits. */
+static size_t
+varint_get(const unsigned char * p, size_t len, uint32_t * v)
+{
+	uint32_t r = 0;
+	size_t n;
+
+	for (n=0;n<len && n<5;n++) {
+		r |= (uint32_t)(p[n] & 0x7f) << (7 * n);
+		if (!(p[n] & 0x80)) {
+			*v = r;
+			return n + 1;
+		}
+	}
+	return 0;
+}
+
+struct profile *
+profile_new()
+{
+	struct profile * profile;
+
+	profile = malloc(sizeof(struct profile));
+	if (!profile) return NULL;
+	memset(profile, 0, sizeof(struct profile));
+
+	profile->zmask = ZOOM_ALL;
+	profile->sizes = map_new(PROFILEMAP_HASHSIZE);
+	profile->groups = map_new(PROFILEMAP_HASHSIZE);
+	if (!profile->sizes || !profile->groups) {
+		profile_unload(profile);
+		return NULL;
+	}
+
+	return profile;
+}
+
+/* Parses the group header at offset off in the blob. Returns the offset
+   of the group's entry data or 0 if the header is truncated. */
+static uint32_t
+profile_group_header(struct profile_source * src, uint32_t off, uint32_t * dsz,
+	uint8_t * z, uint32_t * nr_entries, uint32_t * nr_bytes)
+{
+	const unsigned char * p;
+	size_t len, n;
+
+	p = src->blob + off;
+	len = src->bloblen - off;
+
+	if (!(n = varint_get(p, len, dsz))) return 0;
+	p += n;
+	len -= n;
+	if (!len) return 0;
+	*z = *p++;
+	len--;
+	if (!(n = varint_get(p, len, nr_entries))) return 0;
+	p += n;
+	len -= n;
+	if (!(n = varint_get(p, len, nr_bytes))) return 0;
+	p += n;
+	len -= n;
+	if (len < *nr_bytes) return 0;
+
+	return p - src->blob;
+}
+
+/* Decodes one (size, zoom) group with its header at offset off in the
+   blob and appends its entries to list. */
+static int
+profile_decode_group(struct profile_source * src, uint32_t off,
+	struct list * list)
+{
+	const unsigned char * p;
 	struct profile_entry pe;
-	struct map * map;
-	struct list * list;
-	FILE * f;
+	uint32_t dsz, nr_entries, nr_bytes, i, dx, dy, x, y;
+	size_t len, n;
+	uint8_t z;
 
-	if (!fn) return NULL;
+	off = profile_group_header(src, off, &dsz, &z, &nr_entries,
+		&nr_bytes);
+	if (!off) return -1;
+	p = src->blob + off;
+	len = nr_bytes;
 
-	f = fopen(fn, "r");
-	if (!f) return NULL;
+	x = y = 0;
+	for (i=0;i<nr_entries;i++) {
+		n = varint_get(p, len, &dx);
+		if (!n) return -1;
+		p += n;
+		len -= n;
+		n = varint_get(p, len, &dy);
+		if (!n) return -1;
+		p += n;
+		len -= n;
 
-	map = map_new(PROFILEMAP_HASHSIZE);
-	if (!map) goto err;
+		/* y is stored relative to the previous entry only if both
+		   share the same x value, otherwise it's absolute. */
+		if (dx) y = 0;
+		x += dx;
+		y += dy;
+		if (x >= MAX_X || y >= MAX_Y || z >= MAX_Z)
+			continue;
+		pe.x = x;
+		pe.y = y;
+		pe.z = z;
+		pe.id = src->id;
+		if (list_append(list, &pe) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Indexes the nr_groups group headers found in the blob of source srcidx
+   starting at offset off by size. The entries themselves are left alone
+   until profile_get() asks for them and groups for zoom levels outside of
+   the profile's zoom mask are skipped altogether. */
+static int
+profile_index_groups(struct profile * profile, uint32_t srcidx, uint32_t off,
+	uint32_t nr_groups)
+{
+	struct profile_source * src;
+	struct profile_group group;
+	struct list * groups;
+	uint32_t nr_entries, nr_bytes, i, data, sz, dsz;
+	uint8_t z;
+
+	src = &(profile->sources[srcidx]);
+	group.src = srcidx;
+	sz = 0;
+	for (i=0;i<nr_groups;i++) {
+		data = profile_group_header(src, off, &dsz, &z,
+			&nr_entries, &nr_bytes);
+		if (!data) return -1;
+		sz += dsz;
+
+		if (z < MAX_Z && (profile->zmask & (1 << z))) {
+			groups = map_get(profile->groups, sz);
+			if (!groups) {
+				groups = list_new(sizeof(struct profile_group));
+				if (!groups) return -1;
+				if (map_set(profile->groups, sz, groups) < 0) {
+					list_free(groups);
+					return -1;
+				}
+			}
+			group.off = off;
+			if (list_append(groups, &group) < 0)
+				return -1;
+		}
+
+		off = data + nr_bytes;
+	}
+
+	return 0;
+}
+
+static int
+profile_load_encoded(struct profile * profile, FILE * f, uint8_t id)
+{
+	struct profile_source * src;
+	struct stat st;
+	uint32_t nr_groups[MAX_Z], poff[MAX_Z], plen[MAX_Z];
+	uint32_t i, srcidx, off;
+	uint8_t version;
+	long data_off;
+
+	version = read_uint8(f);
+	if (version != 1 && version != PROFILE_VERSION) return -1;
+
+	if (profile->nr_sources == MAX_REGIONS) return -1;
+	srcidx = profile->nr_sources;
+	src = &(profile->sources[srcidx]);
+	src->id = id;
+
+	if (version == 1) {
+		/* single partition holding all zoom levels, pull in the
+		   rest of the file with a single read */
+		nr_groups[0] = read_uint32(f);
+		if (fstat(fileno(f), &st) < 0 || st.st_size < ftell(f))
+			return -1;
+		src->bloblen = st.st_size - ftell(f);
+		src->blob = malloc(src->bloblen + 1);
+		if (!src->blob) return -1;
+		profile->nr_sources++;
+		if (src->bloblen &&
+				fread(src->blob, src->bloblen, 1, f) != 1)
+			return -1;
+		return profile_index_groups(profile, srcidx, 0, nr_groups[0]);
+	}
+
+	/* One partition per zoom level, only read the partitions which are
+	   selected by the zoom mask. */
+	src->bloblen = 0;
+	for (i=0;i<MAX_Z;i++) {
+		nr_groups[i] = read_uint32(f);
+		poff[i] = read_uint32(f);
+		plen[i] = read_uint32(f);
+		if (profile->zmask & (1 << i))
+			src->bloblen += plen[i];
+	}
+	data_off = ftell(f);
+
+	src->blob = malloc(src->bloblen + 1);
+	if (!src->blob) return -1;
+	profile->nr_sources++;
+
+	off = 0;
+	for (i=0;i<MAX_Z;i++) {
+		if (!(profile->zmask & (1 << i)) || !plen[i]) continue;
+		if (fseek(f, data_off + poff[i], SEEK_SET) < 0 ||
+				fread(src->blob + off, plen[i], 1, f) != 1)
+			return -1;
+		if (profile_index_groups(profile, srcidx, off,
+				nr_groups[i]) < 0)
+			return -1;
+		off += plen[i];
+	}
+
+	return 0;
+}
+
+static int
+profile_load_raw(struct profile * profile, FILE * f, uint8_t id)
+{
+	uint8_t z;
+	uint16_t sz;
+	uint32_t i, j, x, y, nr_entries;
+	struct profile_entry pe;
 
 	for (i=0;i<PROFILEMAP_HASHSIZE;i++) {
 		sz = read_uint16(f);
@@ -32,29 +299,273 @@ profile_load(const char * fn)
 			x = read_uint32(f);
 			y = read_uint32(f);
 			z = read_uint8(f);
-			if (x >= MAX_X || y >= MAX_Y || z >= MAX_Z)
+			if (x >= MAX_X || y >= MAX_Y || z >= MAX_Z ||
+					!(profile->zmask & (1 << z)))
 				continue;
 			pe.x = x;
 			pe.y = y;
 			pe.z = z;
-			list = map_get(map, sz);
-			if (!list) {
-				list = list_new(sizeof(struct profile_entry));
-				if (map_set(map, sz, list) < 0)
-					goto err;
+			pe.id = id;
+			if (profile_add(profile, sz, &pe) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Restricts the zoom levels loaded by the following profile_add_file()
+   calls to the ones set in the bitmask zmask. */
+void
+profile_set_zooms(struct profile * profile, uint32_t zmask)
+{
+	if (!profile) return;
+	profile->zmask = zmask & ZOOM_ALL;
+}
+
+/* Adds the entries of the profile file fn to profile, tagged with the
+   region id. */
+int
+profile_add_file(struct profile * profile, const char * fn, uint8_t id)
+{
+	uint32_t magic;
+	FILE * f;
+	int ret;
+
+	if (!profile || !fn) return -1;
+
+	f = fopen(fn, "r");
+	if (!f) return -1;
+
+	/* Raw profiles start with the header of the empty size 0 bucket so
+	   they can never carry the magic of the encoded format. */
+	if (fread(&magic, 4, 1, f) == 1 && ntohl(magic) == PROFILE_MAGIC) {
+		ret = profile_load_encoded(profile, f, id);
+	}
+	else {
+		rewind(f);
+		ret = profile_load_raw(profile, f, id);
+	}
+
+	fclose(f);
+	return ret;
+}
+
+struct profile *
+profile_load(const char * fn)
+{
+	struct profile * profile;
+
+	profile = profile_new();
+	if (!profile) return NULL;
+
+	if (profile_add_file(profile, fn, 0) < 0) {
+		profile_unload(profile);
+		return NULL;
+	}
+
+	return profile;
+}
+
+struct list *
+profile_get(struct profile * profile, uint32_t sz)
+{
+	struct list * list, * groups;
+	struct profile_group group;
+	uint32_t i, c;
+
+	if (!profile) return NULL;
+
+	list = map_get(profile->sizes, sz);
+	groups = map_get(profile->groups, sz);
+	if (!groups) return list;
+
+	/* first access to this size bucket, expand all its zoom groups */
+	if (!list) {
+		list = list_new(sizeof(struct profile_entry));
+		if (!list) fatal("Out of memory.");
+		if (map_set(profile->sizes, sz, list) < 0)
+			fatal("Out of memory.");
+	}
+	c = list_count(groups);
+	for (i=0;i<c;i++) {
+		list_get(groups, i, &group);
+		if (profile_decode_group(&(profile->sources[group.src]),
+				group.off, list) < 0)
+			fatal("Corrupt group in encoded profile.");
+	}
+	list_free(groups);
+	map_set(profile->groups, sz, NULL);
+
+	return list;
+}
+
+int
+profile_add(struct profile * profile, uint32_t sz, struct profile_entry * pe)
+{
+	struct list * list;
+
+	if (!profile || !pe) return -1;
+
+	list = profile_get(profile, sz);
+	if (!list) {
+		list = list_new(sizeof(struct profile_entry));
+		if (!list) return -1;
+		if (map_set(profile->sizes, sz, list) < 0) {
+			list_free(list);
+			return -1;
+		}
+	}
+
+	return list_append(list, pe);
+}
+
+static void
+profile_save_raw(struct profile * profile, FILE * f)
+{
+	struct list * list;
+	struct profile_entry pe;
+	uint32_t i, j, off;
+
+	for (i=0;i<PROFILEMAP_HASHSIZE;i++) {
+
+		write_uint16(f, i & 0xFFFF);
+
+		list = profile_get(profile, i);
+		if (!list) {
+			write_uint32(f, 0);
+			continue;
+		}
+
+		off = list_count(list);
+		write_uint32(f, off & 0xFFFF);
+
+		for (j=0;j<off;j++) {
+			if (list_get(list, j, &pe) < 0)
+				fatal("Error while retrieving data.");
+			write_uint32(f, pe.x);
+			write_uint32(f, pe.y);
+			write_uint8(f, pe.z);
+		}
+	}
+}
+
+/* Encoded profiles are partitioned by zoom level so a subset of the zoom
+   levels can be loaded without touching the others. A table with the
+   number of groups, offset and length of every partition follows the
+   header. Within a partition the entries of each size bucket form a
+   group, sorted on (x, y) with x stored as a varint delta to the previous
+   entry and y as a varint delta only while x stays the same. Each group
+   header holds the size as a delta to the previous group, the zoom level
+   and the entry and byte counts as varints. Empty groups are not written
+   at all. */
+static void
+profile_save_encoded(struct profile * profile, FILE * f)
+{
+	struct list * list;
+	struct profile_entry ** pes;
+	unsigned char * buf, hdr[16];
+	uint32_t * counts, * starts;
+	uint32_t nr_groups[MAX_Z], poff[MAX_Z], plen[MAX_Z];
+	uint32_t i, j, k, c, z, x, y, last_sz, max;
+	long table_off, data_off, end_off;
+	size_t len, n;
+
+	write_uint32(f, PROFILE_MAGIC);
+	write_uint8(f, PROFILE_VERSION);
+	table_off = ftell(f);
+	for (i=0;i<MAX_Z * 3;i++)
+		write_uint32(f, 0);
+	data_off = ftell(f);
+
+	/* sort every size bucket on (z, x, y) once so the partitions can
+	   just walk the buckets in order */
+	pes = xmalloc(sizeof(struct profile_entry *) * PROFILEMAP_HASHSIZE);
+	counts = xmalloc(sizeof(uint32_t) * PROFILEMAP_HASHSIZE);
+	starts = xmalloc(sizeof(uint32_t) * PROFILEMAP_HASHSIZE);
+	max = 0;
+	for (i=0;i<PROFILEMAP_HASHSIZE;i++) {
+		list = profile_get(profile, i);
+		c = list_count(list);
+		counts[i] = c;
+		if (!c) continue;
+		if (c > max) max = c;
+
+		pes[i] = xmalloc(sizeof(struct profile_entry) * c);
+		for (j=0;j<c;j++)
+			list_get(list, j, &pes[i][j]);
+		qsort(pes[i], c, sizeof(struct profile_entry),
+			profile_entry_compare);
+	}
+	buf = xmalloc(max * 10 + 1);
+
+	for (z=0;z<MAX_Z;z++) {
+		nr_groups[z] = 0;
+		poff[z] = ftell(f) - data_off;
+		last_sz = 0;
+
+		for (i=0;i<PROFILEMAP_HASHSIZE;i++) {
+			if (!counts[i]) continue;
+
+			j = starts[i];
+			len = 0;
+			x = y = 0;
+			for (k=j;k<counts[i] && pes[i][k].z == z;k++) {
+				if (pes[i][k].x != x) y = 0;
+				len += varint_put(buf + len, pes[i][k].x - x);
+				len += varint_put(buf + len, pes[i][k].y - y);
+				x = pes[i][k].x;
+				y = pes[i][k].y;
 			}
+			starts[i] = k;
+			if (k == j) continue;
 
-			if (list_append(list, &pe) < 0)
-				goto err;
+			n = varint_put(hdr, i - last_sz);
+			hdr[n++] = z;
+			n += varint_put(hdr + n, k - j);
+			n += varint_put(hdr + n, len);
+			write_data(f, hdr, n);
+			write_data(f, buf, len);
+			last_sz = i;
+			nr_groups[z]++;
 		}
+
+		plen[z] = ftell(f) - data_off - poff[z];
 	}
 
+	end_off = ftell(f);
+	fseek(f, table_off, SEEK_SET);
+	for (z=0;z<MAX_Z;z++) {
+		write_uint32(f, nr_groups[z]);
+		write_uint32(f, poff[z]);
+		write_uint32(f, plen[z]);
+	}
+	fseek(f, end_off, SEEK_SET);
+
+	for (i=0;i<PROFILEMAP_HASHSIZE;i++) {
+		if (counts[i]) free(pes[i]);
+	}
+	free(pes);
+	free(counts);
+	free(starts);
+	free(buf);
+}
+
+int
+profile_save(struct profile * profile, const char * fn, int encoded)
+{
+	FILE * f;
+
+	if (!profile || !fn) return -1;
+
+	f = fopen(fn, "w+");
+	if (!f) return -1;
+
+	if (encoded) profile_save_encoded(profile, f);
+	else profile_save_raw(profile, f);
+
 	fclose(f);
-	return map;
-err:
-	if (map) profile_unload(map);
-	fclose(f);
-	return NULL;
+	return 0;
 }
 
 void
@@ -64,9 +575,17 @@ _list_free(void * l)
 }
 
 void
-profile_unload(struct map * map)
+profile_unload(struct profile * profile)
 {
-	map_free(map, _list_free);
+	uint32_t i;
+
+	if (!profile) return;
+
+	if (profile->sizes) map_free(profile->sizes, _list_free);
+	if (profile->groups) map_free(profile->groups, _list_free);
+	for (i=0;i<profile->nr_sources;i++)
+		free(profile->sources[i].blob);
+	free(profile);
 }
 
 /* The functions below this comment are slightly modified but essentially
@@ -118,4 +637,228 @@ coord_to_tile(double lat, double lon, int zoom,
 	c2->y = offsety;
 }
 
+/* Batch conversions. These convert many tiles of the same zoom level at
+   once with branch free polynomial approximations instead of libm calls
+   so the compiler can vectorize the loops. Compared to tile_to_coord()
+   the latitude and longitude stay within 1e-12 degrees; coord_to_tile()
+   results only differ when a coordinate lies within 1e-9 tiles of a tile
+   or pixel boundary. bench/bench-coords measures both. */
+
+struct zoom_consts {
+	double world_tiles;
+	double inv_half_tiles;
+	double tiles_per_degree;
+	double tiles_per_radian;
+};
+
+static struct zoom_consts zoom_consts[MAX_Z];
+static int zoom_consts_done = 0;
+
+/* number of coordinates coord_to_tile_batch() handles per pass */
+#define BATCH_CHUNK		256
+
+static void
+zoom_consts_init()
+{
+	int z;
+
+	for (z=0;z<MAX_Z;z++) {
+		zoom_consts[z].world_tiles = ldexp(1.0, 17 - z);
+		zoom_consts[z].inv_half_tiles = 2.0 / zoom_consts[z].world_tiles;
+		zoom_consts[z].tiles_per_degree =
+			zoom_consts[z].world_tiles / 360.0;
+		zoom_consts[z].tiles_per_radian =
+			zoom_consts[z].world_tiles / (2.0 * PI);
+	}
+	zoom_consts_done = 1;
+}
+
+/* exp(t) for |t| <= 700 by reducing to 2^k * exp(r) with |r| <= ln(2)/2
+   and a degree 11 Taylor polynomial for exp(r). The 2^k scale factor is
+   built directly in the exponent bits. */
+inline static double
+exp_approx(double t)
+{
+	union { double d; uint64_t u; } k, scale;
+	double r, p;
+
+	k.d = t * 1.4426950408889634 + 0x1.8p52;
+	r = k.d - 0x1.8p52;
+	r = t - r * 6.93147180369123816490e-01 - r * 1.90821492927058770002e-10;
+	scale.u = (k.u + 1023) << 52;
+
+	p = 1.0 / 39916800.0;
+	p = p * r + 1.0 / 3628800.0;
+	p = p * r + 1.0 / 362880.0;
+	p = p * r + 1.0 / 40320.0;
+	p = p * r + 1.0 / 5040.0;
+	p = p * r + 1.0 / 720.0;
+	p = p * r + 1.0 / 120.0;
+	p = p * r + 1.0 / 24.0;
+	p = p * r + 1.0 / 6.0;
+	p = p * r + 0.5;
+	p = p * r + 1.0;
+	p = p * r + 1.0;
+
+	return p * scale.d;
+}
+
+/* atan(u) for |u| <= tan(5 pi / 16). The argument is reduced around 0,
+   pi / 8 or pi / 4 to |v| <= tan(pi / 16) where the odd Taylor series up
+   to v^23 is accurate to double precision. */
+inline static double
+atan_approx(double u)
+{
+	double a, b1, b2, c, tc, v, w, p;
+
+	/* the bins are picked with arithmetic instead of branches */
+	a = fabs(u);
+	b1 = (a > 0.19891236737965800);
+	b2 = (a > 0.66817863791929891);
+	c = (b1 + b2) * (PI / 8.0);
+	tc = b1 * 0.41421356237309505 + b2 * 0.58578643762690495;
+	v = (a - tc) / (1.0 + a * tc);
+	w = v * v;
+
+	p = -1.0 / 23.0;
+	p = p * w + 1.0 / 21.0;
+	p = p * w - 1.0 / 19.0;
+	p = p * w + 1.0 / 17.0;
+	p = p * w - 1.0 / 15.0;
+	p = p * w + 1.0 / 13.0;
+	p = p * w - 1.0 / 11.0;
+	p = p * w + 1.0 / 9.0;
+	p = p * w - 1.0 / 7.0;
+	p = p * w + 1.0 / 5.0;
+	p = p * w - 1.0 / 3.0;
+	p = p * w + 1.0;
+
+	return copysign(c + v * p, u);
+}
+
+/* sin(x) for |x| <= pi / 2 by its odd Taylor series up to x^21 */
+inline static double
+sin_approx(double x)
+{
+	double w, p;
+
+	w = x * x;
+	p = 1.0 / 51090942171709440000.0;
+	p = p * w - 1.0 / 121645100408832000.0;
+	p = p * w + 1.0 / 355687428096000.0;
+	p = p * w - 1.0 / 1307674368000.0;
+	p = p * w + 1.0 / 6227020800.0;
+	p = p * w - 1.0 / 39916800.0;
+	p = p * w + 1.0 / 362880.0;
+	p = p * w - 1.0 / 5040.0;
+	p = p * w + 1.0 / 120.0;
+	p = p * w - 1.0 / 6.0;
+	p = p * w + 1.0;
+
+	return x * p;
+}
+
+/* log(q) for finite q > 0. The mantissa m is reduced to [sqrt(1/2),
+   sqrt(2)) and log(m) = 2 atanh((m - 1) / (m + 1)) is summed up to the
+   19th power, which is accurate to double precision there. */
+inline static double
+log_approx(double q)
+{
+	union { double d; uint64_t u; } m, ex;
+	double e, s, w, p, big;
+
+	/* the exponent is turned into a double through the bits of 2^52 + e
+	   since there is no vector conversion from 64 bit integers */
+	m.d = q;
+	ex.u = ((m.u >> 52) & 0x7ff) | 0x4330000000000000ULL;
+	e = ex.d - 0x1p52 - 1023.0;
+	m.u = (m.u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+	big = (m.d > 1.4142135623730951);
+	m.d *= 1.0 - 0.5 * big;
+	e += big;
+
+	s = (m.d - 1.0) / (m.d + 1.0);
+	w = s * s;
+	p = 1.0 / 19.0;
+	p = p * w + 1.0 / 17.0;
+	p = p * w + 1.0 / 15.0;
+	p = p * w + 1.0 / 13.0;
+	p = p * w + 1.0 / 11.0;
+	p = p * w + 1.0 / 9.0;
+	p = p * w + 1.0 / 7.0;
+	p = p * w + 1.0 / 5.0;
+	p = p * w + 1.0 / 3.0;
+	p = p * w + 1.0;
+
+	return 2.0 * s * p + e * 0.69314718055994530942;
+}
+
+/* Converts the top left corners of n tiles of one zoom level to their
+   latitudes and longitudes, see tile_to_coord(). */
+void
+tile_to_coord_batch(uint8_t zoom, const struct coord * c, size_t n,
+	double * dlat, double * dlon)
+{
+	const struct zoom_consts * zc;
+	double x, y, u;
+	size_t i;
+
+	if (!zoom_consts_done) zoom_consts_init();
+	if (zoom >= MAX_Z) return;
+	zc = &(zoom_consts[zoom]);
+
+	/* asin(tanh(t)) is rewritten as 2 atan(tanh(t / 2)) so the only
+	   transcendental parts left are one exp and one atan */
+	for (i=0;i<n;i++) {
+		x = c[i].x * zc->inv_half_tiles - 1.0;
+		y = c[i].y * zc->inv_half_tiles - 1.0;
+		dlon[i] = x * 180.0;
+		u = exp_approx(-y * PI);
+		dlat[i] = atan_approx((u - 1.0) / (u + 1.0)) * (360.0 / PI);
+	}
+}
+
+/* Converts n latitude/longitude pairs to tiles and pixel offsets within
+   those tiles on one zoom level, see coord_to_tile(). Just like there
+   latitudes beyond the limits of the Mercator projection give tiles
+   outside of the world. */
+void
+coord_to_tile_batch(int zoom, const double * lat, const double * lon,
+	size_t n, struct coord * c1, struct coord * c2)
+{
+	const struct zoom_consts * zc;
+	double xs[BATCH_CHUNK], ys[BATCH_CHUNK];
+	double x, y, e;
+	int world_tiles;
+	size_t i, j, len;
+
+	if (!zoom_consts_done) zoom_consts_init();
+	if (zoom < 0 || zoom >= MAX_Z) return;
+	zc = &(zoom_consts[zoom]);
+	world_tiles = tiles_on_level(zoom);
+
+	/* the floating point part runs over a chunk first so that loop
+	   stays free of the integer conversions and can be vectorized */
+	for (i=0;i<n;i+=len) {
+		len = (n - i < BATCH_CHUNK ? n - i : BATCH_CHUNK);
+
+		for (j=0;j<len;j++) {
+			xs[j] = zc->tiles_per_degree * (lon[i + j] + 180.0);
+			e = sin_approx(lat[i + j] * (PI / 180.0));
+			ys[j] = zc->world_tiles / 2.0 - 0.5 *
+				log_approx((1.0 + e) / (1.0 - e)) *
+				zc->tiles_per_radian;
+		}
+
+		for (j=0;j<len;j++) {
+			x = xs[j];
+			y = ys[j];
+			c2[i + j].x = (int)((x - (int)x) * 256.0);
+			c2[i + j].y = (int)((y - (int)y) * 256.0);
+			c1[i + j].x = ((int)(x) % world_tiles);
+			c1[i + j].y = ((int)(y) % world_tiles);
+		}
+	}
+}
+
 /* EOF */
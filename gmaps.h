@@ -11,13 +11,36 @@
 #include "utils.h"
 
 /* hash sizes for tables must be prime */
-#define SESSIONMAP_HASHSIZE		1009
-#define TSMAP_HASHSIZE			1009
+#define SESSIONMAP_HASHSIZE		65521
 
 /* assume there are no tiles with size >= 30kB, so choose lowest
    prime bigger than that. */
 #define PROFILEMAP_HASHSIZE		30727
 
+/* seconds between the statistics printed by gmaps-trafficker, and
+   between the updates the capture process sends for them */
+#define STATS_INTERVAL			60
+#define STATS_UPDATE_INTERVAL		1
+
+/* the kernel filter doesn't depend on the servers, their flows are
+   picked out by libtrafficker */
+#define CAPTURE_FILTER			"tcp port 443"
+
+/* the capture process gets the bursts in batches of at most this many,
+   held back for at most this many microseconds. A batch of pairs has to
+   fit in a single write of PIPE_BUF bytes. */
+#define CAPTURE_BATCH			64
+#define CAPTURE_BATCH_USEC		1000
+
+/* with several capture files the entries are merged once they are this
+   many seconds older than what each running capture process sent, as
+   far as libtrafficker follows the sessions of a file into the next
+   ones */
+#define MERGE_HOLD_SEC			300
+
+/* default length of the analysis windows in milliseconds */
+#define ANALYZE_WINDOW_MS		2000
+
 /* minimum and maximum lenght of tiles */
 #define MIN_TILE_LEN			(2 * 1024)
 #define MAX_TILE_LEN			(30 * 1024)
@@ -25,9 +48,23 @@
 /* defines range to retrieve coordinates for a tile from the database */
 #define TILE_LEN_RANGE			1024	
 
+/* minimum and maximum number of tiles in a retangle */
+#define RETANGLE_MINDIM			3
+#define RETANGLE_MAXDIM			18
+
 /* maximum entries to use for calculating the histogram */
 #define MAX_HISTOGRAM			100
 
+/* zoom levels that didn't produce retangles for this many analysis
+   windows in a row are skipped while matching, but every
+   ZOOM_PROBE_WINDOWS windows all loaded zoom levels are tried again */
+#define ZOOM_IDLE_WINDOWS		30
+#define ZOOM_PROBE_WINDOWS		10
+
+/* encoded profile format, see profile_save_encoded() */
+#define PROFILE_MAGIC			0x474d5045
+#define PROFILE_VERSION			2
+
 /* default profile name */
 #define DEFAULT_FN			"gmaps_profile.dat"
 
@@ -35,6 +72,10 @@
 #define MAX_X				200000
 #define MAX_Y				200000
 #define MAX_Z				20
+#define ZOOM_ALL			((1 << MAX_Z) - 1)
+
+/* maximum number of profiles (regions) matched at the same time */
+#define MAX_REGIONS			32
 
 #define PI 			3.14159265358979323846
 
@@ -43,13 +84,21 @@ struct profile_entry {
 	uint32_t x;
 	uint32_t y;
 	uint8_t  z;
+	uint8_t  id;
 };
 
 /* one http request/response pair */
 struct http_entry {
-	time_t ts;
+	/* capture time of the response in microseconds since the epoch */
+	uint64_t ts;
 	size_t reslen;
 	size_t reqlen;
+	/* CLOCK_MONOTONIC nanoseconds when the last data of the response
+	   was reassembled, when its burst was handed over and when the
+	   analyzer received the pair */
+	uint64_t ts_data;
+	uint64_t ts_emit;
+	uint64_t ts_recv;
 };
 
 /* coordinate in World Coordinate System */
@@ -58,12 +107,24 @@ struct coord {
 	uint32_t y;
 };
 
-struct map * profile_load(const char *);
-void profile_unload(struct map *);
+struct profile;
+
+struct profile * profile_new();
+struct profile * profile_load(const char *);
+int profile_add_file(struct profile *, const char *, uint8_t);
+void profile_set_zooms(struct profile *, uint32_t);
+struct list * profile_get(struct profile *, uint32_t);
+int profile_add(struct profile *, uint32_t, struct profile_entry *);
+int profile_save(struct profile *, const char *, int);
+void profile_unload(struct profile *);
 void _list_free(void *);
 int tiles_on_level(int);
 void tile_to_coord(uint8_t, struct coord *, int, int, double *, double *);
 void coord_to_tile(double, double, int,	struct coord *, struct coord *);
+void tile_to_coord_batch(uint8_t, const struct coord *, size_t,
+	double *, double *);
+void coord_to_tile_batch(int, const double *, const double *, size_t,
+	struct coord *, struct coord *);
 
 #endif
 
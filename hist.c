@@ -0,0 +1,75 @@
+/* hist.c */
+
+/* Log-linear histograms in the style of HdrHistogram. Values below
+   2^HIST_SUB_BITS get a bucket each, every power of two range above
+   that is divided into 2^HIST_SUB_BITS equally wide buckets. Recording
+   a value is a couple of shifts and an increment, percentiles are read
+   by walking the buckets. */
+
+#include "hist.h"
+
+#define SUB_COUNT	(1 << HIST_SUB_BITS)
+
+static uint32_t
+hist_index(uint64_t v)
+{
+	uint32_t e;
+
+	if (v < SUB_COUNT) return v;
+
+	e = 63 - __builtin_clzll(v);
+	return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+		((v >> (e - HIST_SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+/* Returns the highest value that falls in bucket idx. */
+static uint64_t
+hist_value(uint32_t idx)
+{
+	uint32_t shift;
+	uint64_t sub;
+
+	if (idx < SUB_COUNT) return idx;
+
+	shift = (idx >> HIST_SUB_BITS) - 1;
+	sub = SUB_COUNT + (idx & (SUB_COUNT - 1));
+	return ((sub + 1) << shift) - 1;
+}
+
+void
+hist_add(struct hist * h, uint64_t v)
+{
+	if (!h) return;
+
+	if (!h->count || v < h->min) h->min = v;
+	if (v > h->max) h->max = v;
+	h->count++;
+	h->buckets[hist_index(v)]++;
+}
+
+/* Returns the value below or at which p percent of the values are, as
+   the top of its bucket but never above the biggest value seen. */
+uint64_t
+hist_percentile(const struct hist * h, double p)
+{
+	uint64_t rank, seen;
+	uint32_t i;
+
+	if (!h || !h->count) return 0;
+
+	if (p <= 0) return h->min;
+	rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank >= h->count) return h->max;
+
+	seen = 0;
+	for (i=0;i<HIST_BUCKETS;i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) break;
+	}
+
+	if (hist_value(i) > h->max) return h->max;
+	return hist_value(i);
+}
+
+/* EOF */
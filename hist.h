@@ -0,0 +1,26 @@
+/* hist.h */
+
+#ifndef HIST_H
+  #define HIST_H
+
+#include <stdint.h>
+
+/* every power of two range of values is split into 2^HIST_SUB_BITS
+   buckets, so values are kept with a relative error below 2^-5 */
+#define HIST_SUB_BITS		5
+#define HIST_BUCKETS		((65 - HIST_SUB_BITS) << HIST_SUB_BITS)
+
+/* a zeroed struct hist is an empty histogram */
+struct hist {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+void hist_add(struct hist *, uint64_t);
+uint64_t hist_percentile(const struct hist *, double);
+
+#endif
+
+/* EOF */
@@ -19,29 +19,38 @@ buffer_new()
 	}
 
 	b->len = 0;
-	b->alloc = 1024;
+	b->alloc = BUFFER_INIT_SIZE;
 	b->data = malloc(b->alloc);
 	if (!(b->data)) {
 		fprintf(stderr, "Cannot allocate memory.\n");
 		exit(EXIT_FAILURE);
-		free(b);
 	}
 
-	memset(b->data, 0, b->alloc);
 	return b;
 }
 
+/* Buffers grow by doubling so appending many small pieces stays cheap. */
 void
 buffer_append(struct buffer * b, const char * data, size_t len)
 {
+	size_t alloc;
+	char * p;
+
 	if (!b || !data || !len) {
 		fprintf(stderr, "Wrong arguments.\n");
 		exit(EXIT_FAILURE);
 	}
 
 	if ((b->len + len) > b->alloc) {
-		b->alloc = b->len + len;
-		b->data = realloc(b->data, b->alloc);
+		alloc = b->alloc * 2;
+		if (alloc < b->len + len) alloc = b->len + len;
+		p = realloc(b->data, alloc);
+		if (!p) {
+			fprintf(stderr, "Cannot allocate memory.\n");
+			exit(EXIT_FAILURE);
+		}
+		b->data = p;
+		b->alloc = alloc;
 	}
 	memcpy(b->data + b->len, data, len);
 	b->len += len;
@@ -50,14 +59,21 @@ buffer_append(struct buffer * b, const char * data, size_t len)
 void
 buffer_reset(struct buffer * b)
 {
+	char * p;
+
 	if (!b) {
 		fprintf(stderr, "Wrong arguments.\n");
 		exit(EXIT_FAILURE);
 	}
 
 	b->len = 0;
-	b->data = realloc(b->data, 1024);
-	b->alloc = 1024;
+	if (b->alloc <= BUFFER_KEEP_MAX) return;
+
+	/* if it can't be shrunk the larger block is kept */
+	p = realloc(b->data, BUFFER_KEEP_MAX);
+	if (!p) return;
+	b->data = p;
+	b->alloc = BUFFER_KEEP_MAX;
 }
 
 void
@@ -3,6 +3,11 @@
 #ifndef BUFFER_H
   #define BUFFER_H
 
+/* initial size of a buffer, a reset keeps the memory of a buffer unless
+   it grew beyond BUFFER_KEEP_MAX */
+#define BUFFER_INIT_SIZE	1024
+#define BUFFER_KEEP_MAX		(64 * 1024)
+
 struct buffer {
 	size_t len;
 	size_t alloc;
@@ -0,0 +1,248 @@
+/* export.c */
+
+/* Export of the packets of selected flows to a capture file. Whether a
+   flow is wanted is only known after some of its packets went by, so
+   the packets of undecided flows are queued. The queue is kept in
+   capture order and only its head is written out or dropped, which
+   keeps the exported file in the same order as the capture. Every flow
+   is referenced by the queued packets and by its owner, the session or
+   the handshake slot, and it is dropped when the owner lets go of it
+   while it is still undecided. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "export.h"
+
+/* queued packets are padded to keep the headers aligned */
+#define EXPORT_ALIGN(x)		(((x) + 7) & ~((size_t)7))
+
+struct export_rec {
+	struct export_flow * flow;
+	struct pcap_pkthdr hdr;
+};
+
+struct export {
+	pcap_dumper_t * dumper;
+	unsigned char * queue;
+	size_t head;
+	size_t len;
+	size_t alloc;
+	struct export_flow ** pending;
+};
+
+struct export *
+export_open(pcap_t * pcap, const char * fname)
+{
+	struct export * x;
+
+	if (!pcap || !fname) return NULL;
+
+	x = malloc(sizeof(struct export));
+	if (!x) return NULL;
+	memset(x, 0, sizeof(struct export));
+
+	x->pending = calloc(EXPORT_PENDING_SLOTS,
+		sizeof(struct export_flow *));
+	if (!x->pending) {
+		free(x);
+		return NULL;
+	}
+
+	x->dumper = pcap_dump_open(pcap, fname);
+	if (!x->dumper) {
+		free(x->pending);
+		free(x);
+		return NULL;
+	}
+
+	return x;
+}
+
+static struct export_flow *
+export_flow_new(const struct tuple4 * addr)
+{
+	struct export_flow * f;
+
+	f = malloc(sizeof(struct export_flow));
+	if (!f) return NULL;
+
+	f->state = EXPORT_UNDECIDED;
+	f->refs = 1;
+	memcpy(&(f->addr), addr, sizeof(struct tuple4));
+	return f;
+}
+
+static void
+export_unref(struct export_flow * f)
+{
+	if (--f->refs == 0) free(f);
+}
+
+/* Writes out or drops the packets at the head of the queue as far as
+   their flows are decided. Undecided flows are given up when their
+   oldest packet is too old or the queue too big. */
+static void
+export_release(struct export * x, time_t now)
+{
+	struct export_rec * rec;
+	struct export_flow * f;
+
+	while (x->head < x->len) {
+		rec = (struct export_rec *)(x->queue + x->head);
+		f = rec->flow;
+		if (f->state == EXPORT_UNDECIDED) {
+			if (now - rec->hdr.ts.tv_sec < EXPORT_HOLD_TIME &&
+					x->len - x->head < EXPORT_MAX_QUEUE)
+				break;
+			f->state = EXPORT_DROP;
+		}
+		if (f->state == EXPORT_KEEP)
+			pcap_dump((u_char *)x->dumper, &(rec->hdr),
+				(u_char *)(rec + 1));
+		x->head += EXPORT_ALIGN(sizeof(struct export_rec) +
+			rec->hdr.caplen);
+		export_unref(f);
+	}
+
+	if (x->head == x->len) x->head = x->len = 0;
+	else if (x->head > x->alloc / 2) {
+		memmove(x->queue, x->queue + x->head, x->len - x->head);
+		x->len -= x->head;
+		x->head = 0;
+	}
+}
+
+/* Gets the flow of a connection which didn't finish its handshake yet,
+   optionally creating it. A flow already in the slot is given up. */
+struct export_flow *
+export_pending(struct export * x, const struct tuple4 * addr,
+	uint64_t hash, int create)
+{
+	struct export_flow ** slot, * f;
+
+	if (!x || !addr) return NULL;
+
+	slot = &(x->pending[hash % EXPORT_PENDING_SLOTS]);
+	f = *slot;
+	if (f && !memcmp(&(f->addr), addr, sizeof(struct tuple4))) return f;
+	if (!create) return NULL;
+
+	f = export_flow_new(addr);
+	if (!f) return NULL;
+	if (*slot) export_flow_put(x, *slot);
+	*slot = f;
+	return f;
+}
+
+/* Takes over the flow of a connection that just got established, the
+   caller becomes its owner. */
+struct export_flow *
+export_adopt(struct export * x, const struct tuple4 * addr, uint64_t hash)
+{
+	struct export_flow ** slot, * f;
+
+	if (!x || !addr) return NULL;
+
+	slot = &(x->pending[hash % EXPORT_PENDING_SLOTS]);
+	f = *slot;
+	if (f && !memcmp(&(f->addr), addr, sizeof(struct tuple4))) {
+		*slot = NULL;
+		return f;
+	}
+
+	/* the handshake was missed, the flow can still be exported but
+	   won't be usable without it */
+	f = export_flow_new(addr);
+	if (f) f->state = EXPORT_DROP;
+	return f;
+}
+
+/* Lets go of a flow as its owner. */
+void
+export_flow_put(struct export * x, struct export_flow * f)
+{
+	if (!x || !f) return;
+
+	if (f->state == EXPORT_UNDECIDED) f->state = EXPORT_DROP;
+	export_unref(f);
+	export_release(x, 0);
+}
+
+void
+export_packet(struct export * x, struct export_flow * f,
+	const struct pcap_pkthdr * hdr, const u_char * data)
+{
+	struct export_rec * rec;
+	unsigned char * queue;
+	size_t len, alloc;
+
+	if (!x || !f || !hdr || !data) return;
+
+	if (f->state == EXPORT_DROP) {
+		export_release(x, hdr->ts.tv_sec);
+		return;
+	}
+
+	/* a kept flow only needs to queue behind undecided ones */
+	if (f->state == EXPORT_KEEP && x->head == x->len) {
+		pcap_dump((u_char *)x->dumper, hdr, data);
+		return;
+	}
+
+	len = EXPORT_ALIGN(sizeof(struct export_rec) + hdr->caplen);
+	if (x->len + len > x->alloc) {
+		alloc = (x->alloc ? x->alloc : 64 * 1024);
+		while (alloc < x->len + len) alloc *= 2;
+		queue = realloc(x->queue, alloc);
+		if (!queue) {
+			f->state = EXPORT_DROP;
+			export_release(x, hdr->ts.tv_sec);
+			return;
+		}
+		x->queue = queue;
+		x->alloc = alloc;
+	}
+
+	rec = (struct export_rec *)(x->queue + x->len);
+	rec->flow = f;
+	memcpy(&(rec->hdr), hdr, sizeof(struct pcap_pkthdr));
+	memcpy(rec + 1, data, hdr->caplen);
+	x->len += len;
+	f->refs++;
+
+	export_release(x, hdr->ts.tv_sec);
+}
+
+/* Decides whether to keep or drop an undecided flow. */
+void
+export_decide(struct export * x, struct export_flow * f, int keep)
+{
+	if (!x || !f) return;
+
+	if (f->state == EXPORT_UNDECIDED)
+		f->state = (keep ? EXPORT_KEEP : EXPORT_DROP);
+	export_release(x, 0);
+}
+
+/* Drops all flows still undecided and writes out the rest. */
+void
+export_close(struct export * x)
+{
+	uint32_t i;
+
+	if (!x) return;
+
+	for (i=0;i<EXPORT_PENDING_SLOTS;i++) {
+		if (x->pending[i]) export_flow_put(x, x->pending[i]);
+	}
+	free(x->pending);
+
+	export_release(x, (time_t)1 << 62);
+	free(x->queue);
+	pcap_dump_close(x->dumper);
+	free(x);
+}
+
+/* EOF */
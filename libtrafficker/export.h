@@ -0,0 +1,45 @@
+/* export.h */
+
+#ifndef EXPORT_H
+  #define EXPORT_H
+
+#include <stdint.h>
+#include <pcap.h>
+#include <nids.h>
+
+/* packets of flows which are still undecided are held back at most this
+   many seconds of capture time and the queue holds at most this many
+   bytes, the undecided flow at the head is given up when either limit
+   is reached */
+#define EXPORT_HOLD_TIME	30
+#define EXPORT_MAX_QUEUE	(256 * 1024 * 1024)
+
+/* number of slots for flows which didn't finish their handshake yet */
+#define EXPORT_PENDING_SLOTS	65536
+
+#define EXPORT_UNDECIDED	0
+#define EXPORT_KEEP		1
+#define EXPORT_DROP		2
+
+struct export_flow {
+	int state;
+	uint32_t refs;
+	struct tuple4 addr;
+};
+
+struct export;
+
+struct export * export_open(pcap_t *, const char *);
+struct export_flow * export_pending(struct export *, const struct tuple4 *,
+	uint64_t, int);
+struct export_flow * export_adopt(struct export *, const struct tuple4 *,
+	uint64_t);
+void export_flow_put(struct export *, struct export_flow *);
+void export_packet(struct export *, struct export_flow *,
+	const struct pcap_pkthdr *, const u_char *);
+void export_decide(struct export *, struct export_flow *, int);
+void export_close(struct export *);
+
+#endif
+
+/* EOF */
@@ -1,74 +1,99 @@
 /* hash.c */
 
-/* ACKNOWLEDGEMENT: this was taken from libnet-1.24 */
+/* Flow hash, SipHash-1-3 of the two endpoints of a connection under a
+   random key. The endpoints are put in a fixed order first so both
+   directions of a connection get the same hash. An endpoint of address
+   and port fits in a 64 bit word, so a hash is two compression rounds
+   and the finalization, no loop over bytes. */
 
-#include <sys/types.h>
-#include <sys/time.h>
-#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/time.h>
+
+#include "hash.h"
+
+#define ROTL(x, b)	(uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
 
-static u_char xor[12];
-static u_char perm[12];
+#define SIPROUND(v0, v1, v2, v3) do { \
+	v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+	v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+} while (0)
+
+static uint64_t key[2];
+
+/* Gets the key from /dev/urandom, or from the clock if it can't be
+   read. The key only has to be unknown to whoever sends the traffic. */
 static void
-getrnd ()
+getrnd()
 {
-  struct timeval s;
-  u_int *ptr;
-  int fd = open ("/dev/urandom", O_RDONLY);
-  if (fd > 0)
-    {
-      read (fd, xor, 12);
-      read (fd, perm, 12);
-      close (fd);
-      return;
-    }
-
-  gettimeofday (&s, 0);
-  srand (s.tv_usec);
-  ptr = (u_int *) xor;
-  *ptr = rand ();
-  *(ptr + 1) = rand ();
-  *(ptr + 2) = rand ();
-  ptr = (u_int *) perm;
-  *ptr = rand ();
-  *(ptr + 1) = rand ();
-  *(ptr + 2) = rand ();
+	struct timeval tv;
+	int fd;
 
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd >= 0) {
+		if (read(fd, key, sizeof(key)) == sizeof(key)) {
+			close(fd);
+			return;
+		}
+		close(fd);
+	}
 
+	gettimeofday(&tv, NULL);
+	srandom(tv.tv_sec ^ tv.tv_usec ^ getpid());
+	key[0] = ((uint64_t)random() << 32) ^ random();
+	key[1] = ((uint64_t)random() << 32) ^ random();
 }
+
 void
-init_hash ()
+init_hash()
 {
-  int i, n, j;
-  int p[12];
-  getrnd ();
-  for (i = 0; i < 12; i++)
-    p[i] = i;
-  for (i = 0; i < 12; i++)
-    {
-      n = perm[i] % (12 - i);
-      perm[i] = p[n];
-      for (j = 0; j < 11 - n; j++)
-	p[n + j] = p[n + j + 1];
-    }
+	getrnd();
 }
 
-u_int
-mkhash (u_int src, u_short sport, u_int dest, u_short dport)
+/* Returns the hash of the connection between the two endpoints, it's
+   the same whichever endpoint is passed first. */
+uint64_t
+mkhash(uint32_t src, uint16_t sport, uint32_t dest, uint16_t dport)
 {
-  u_int res = 0;
-  int i;
-  u_char data[12];
-  u_int *stupid_strict_aliasing_warnings=(u_int*)data;
-  *stupid_strict_aliasing_warnings = src;
-  *(u_int *) (data + 4) = dest;
-  *(u_short *) (data + 8) = sport;
-  *(u_short *) (data + 10) = dport;
-  for (i = 0; i < 12; i++)
-    res = ( (res << 8) + (data[perm[i]] ^ xor[i])) % 0xff100f;
-  return res;
+	uint64_t v0, v1, v2, v3, a, b, m;
+
+	a = ((uint64_t)src << 16) | sport;
+	b = ((uint64_t)dest << 16) | dport;
+	if (a > b) {
+		m = a;
+		a = b;
+		b = m;
+	}
+
+	v0 = key[0] ^ 0x736f6d6570736575ULL;
+	v1 = key[1] ^ 0x646f72616e646f6dULL;
+	v2 = key[0] ^ 0x6c7967656e657261ULL;
+	v3 = key[1] ^ 0x7465646279746573ULL;
+
+	v3 ^= a;
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= a;
+
+	v3 ^= b;
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= b;
+
+	/* last block only holds the message length of 16 bytes */
+	m = (uint64_t)16 << 56;
+	v3 ^= m;
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= m;
+
+	v2 ^= 0xff;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+
+	return v0 ^ v1 ^ v2 ^ v3;
 }
 
 /* EOF */
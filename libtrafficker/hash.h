@@ -3,8 +3,10 @@
 #ifndef HASH_H
   #define HASH_H
 
+#include <stdint.h>
+
 void init_hash();
-uint32_t mkhash(uint32_t, uint16_t, uint32_t, uint16_t);
+uint64_t mkhash(uint32_t, uint16_t, uint32_t, uint16_t);
 
 #endif
 
@@ -5,28 +5,111 @@
 
 #include <pcap.h>
 
+#include "ssl.h"
+
+/* packets of capture files passed with trafficker_add_tail() are only
+   followed as long as the still open sessions had traffic within this
+   many seconds of capture time */
+#define TAIL_IDLE_TIMEOUT	300
+
+/* sessions are allocated this many at a time */
+#define SESSION_SLAB_SIZE	256
+
+/* records taken from the scanner at a time */
+#define SCAN_RECORDS		64
+
 #ifndef PCAP_NETMASK_UNKNOWN
   /* older versions of libpcap don't seem to define this */
   #define PCAP_NETMASK_UNKNOWN 0xffffffff
 #endif
 
+/* Counters of the capture, they are only written by the thread running
+   trafficker_loop() and get a cache line of their own so they can be
+   bumped with plain increments. */
+struct tr_counters {
+	uint64_t packets;
+	uint64_t packets_skipped;
+	uint64_t flows;
+	uint64_t flows_closed;
+	uint64_t flows_reset;
+	uint64_t flows_timed_out;
+	uint64_t flows_skipped;
+	uint64_t bytes_reassembled;
+	uint64_t bytes_skipped;
+	uint64_t ssl_records;
+	uint64_t bursts;
+} __attribute__((aligned(64)));
+
 struct trafficker {
+	struct tr_counters stats;
 	size_t max_mem;
 	size_t max_fork;
 	int live_cap;
 	int loop;
 	int burst_join;
+	uint32_t burst_gap;
 	pcap_t * pcap;
+	struct pcapfile * file;
+	struct bpf_program filter;
+	int have_filter;
+	/* with prefixes added only flows with one end in them are passed
+	   on to libnids */
+	struct lpm * servers;
+	char ** tails;
+	int nr_tails;
+	uint32_t open_sessions;
+	time_t last_ts;
+	struct export * export;
+	struct tr_session * cb_session;
+	struct tr_session * free_sessions;
+	struct tr_slab * slabs;
 	void (*cb)(const struct burst *);
+
+	/* bursts and closes waiting for the batch handler, with the
+	   sessions they belong to */
+	void (*batch_cb)(const struct burst *, size_t);
+	struct burst * batch;
+	struct tr_session ** batch_sessions;
+	size_t batch_max;
+	size_t nr_batch;
+	uint64_t batch_ns;
+	uint64_t batch_start;
+	int flushing;
+	/* closed sessions are only freed after the batch went out */
+	struct tr_session * closing;
 };
 
 static struct trafficker * current;
 
+/* Application data of the records completed in one direction since it
+   was last between two records. */
+struct tr_pending {
+	uint32_t len;
+	uint32_t nr_records;
+	uint16_t records[BURST_MAX_RECORDS];
+};
+
 struct tr_session {
 	int first_burst;
+	int checked;
 	struct burst last_burst;
+	/* capture time in microseconds of the last data of the session */
+	uint64_t last_data;
+	/* the first bytes of a direction are buffered until they look like
+	   SSL, then everything goes straight through the scanner, the
+	   direction the client sends is index 1 */
 	struct buffer * sbuf;
 	struct buffer * cbuf;
+	struct ssl_scan scan[2];
+	struct tr_pending pending[2];
+	uint64_t hash;
+	struct export_flow * xflow;
+	struct tr_session * next;
+};
+
+struct tr_slab {
+	struct tr_slab * next;
+	struct tr_session sessions[SESSION_SLAB_SIZE];
 };
 
 #endif
@@ -1,8 +1,11 @@
 /* libtrafficker.c */
 
+#include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <netinet/in.h>
 
 #include <nids.h>
 
@@ -11,6 +14,10 @@
 #include "ssl.h"
 #include "buffer.h"
 #include "hash.h"
+#include "lpm.h"
+#include "pcapfile.h"
+#include "export.h"
+#include "probes.h"
 
 extern struct pcap_pkthdr * nids_last_pcap_header;
 
@@ -55,6 +62,45 @@ trafficker_open(pcap_t * pcap, const char * filter)
 	return t;
 }
 
+/* Capture files which pcapfile can read are mapped and parsed in place,
+   libpcap only provides a dead handle for libnids to get the link type
+   from and the filter is run on every packet in trafficker_loop(). */
+static struct trafficker *
+trafficker_open_file(const char * fname, const char * filter)
+{
+	struct trafficker * t;
+	struct pcapfile * pf;
+	pcap_t * pcap;
+
+	pf = pcapfile_open(fname);
+	if (!pf) return NULL;
+
+	pcap = pcap_open_dead(pcapfile_linktype(pf), pcapfile_snaplen(pf));
+	if (!pcap) {
+		pcapfile_close(pf);
+		return NULL;
+	}
+
+	t = trafficker_open(pcap, NULL);
+	if (!t) {
+		pcap_close(pcap);
+		pcapfile_close(pf);
+		return NULL;
+	}
+	t->file = pf;
+
+	if (filter) {
+		if (pcap_compile(pcap, &(t->filter), filter, 1,
+				PCAP_NETMASK_UNKNOWN) < 0) {
+			trafficker_close(t);
+			return NULL;
+		}
+		t->have_filter = 1;
+	}
+
+	return t;
+}
+
 struct trafficker *
 trafficker_open_offline(const char * fname, const char * filter)
 {
@@ -64,6 +110,10 @@ trafficker_open_offline(const char * fname, const char * filter)
 
 	if (!fname) return NULL;
 
+	/* anything pcapfile doesn't understand is left to libpcap */
+	t = trafficker_open_file(fname, filter);
+	if (t) return t;
+
 	pcap = pcap_open_offline(fname, errbuf);
 	if (!pcap) return NULL;
 
@@ -101,52 +151,263 @@ trafficker_open_online(const char * device, const char * filter)
 	return t;
 }
 
+/* Sessions come from slabs and go back on a free list when they are
+   done, their buffers are only allocated once there is data in that
+   direction. */
+static struct tr_session *
+session_new(struct trafficker * tr)
+{
+	struct tr_session * session;
+	struct tr_slab * slab;
+	int i;
+
+	if (!tr->free_sessions) {
+		slab = malloc(sizeof(struct tr_slab));
+		if (!slab) return NULL;
+		slab->next = tr->slabs;
+		tr->slabs = slab;
+		for (i=0;i<SESSION_SLAB_SIZE;i++) {
+			slab->sessions[i].next = tr->free_sessions;
+			tr->free_sessions = &(slab->sessions[i]);
+		}
+	}
+
+	session = tr->free_sessions;
+	tr->free_sessions = session->next;
+
+	session->sbuf = NULL;
+	session->cbuf = NULL;
+	session->first_burst = 1;
+	session->checked = 0;
+	ssl_scan_init(&(session->scan[0]));
+	ssl_scan_init(&(session->scan[1]));
+	memset(session->pending, 0, sizeof(session->pending));
+	memset(&(session->last_burst), 0, sizeof(struct burst));
+	session->xflow = NULL;
+	return session;
+}
+
+static void
+session_free(struct trafficker * tr, struct tr_session * session)
+{
+	if (session->sbuf) buffer_free(session->sbuf);
+	if (session->cbuf) buffer_free(session->cbuf);
+	export_flow_put(tr->export, session->xflow);
+
+	session->next = tr->free_sessions;
+	tr->free_sessions = session;
+}
+
+/* Capture time of the packet being handled in microseconds, live it is
+   the time the kernel stamped the packet with. */
+static uint64_t
+packet_usec()
+{
+	return (uint64_t)nids_last_pcap_header->ts.tv_sec * 1000000 +
+		nids_last_pcap_header->ts.tv_usec;
+}
+
+/* Returns CLOCK_MONOTONIC in nanoseconds, the clock of the ts_data and
+   ts_emit of the bursts. */
+static uint64_t
+clock_ns()
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (uint64_t)tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+/* Hands the queued bursts to the batch handler. Sessions closed in the
+   meantime are only freed afterwards, as bursts of the batch can still
+   refer to them. */
+static void
+batch_flush(struct trafficker * tr)
+{
+	struct tr_session * session;
+
+	if (tr->nr_batch) {
+		tr->flushing = 1;
+		tr->batch_cb(tr->batch, tr->nr_batch);
+		tr->flushing = 0;
+		tr->nr_batch = 0;
+	}
+
+	while ((session = tr->closing) != NULL) {
+		tr->closing = session->next;
+		session_free(tr, session);
+	}
+}
+
+static void
+batch_add(struct trafficker * tr, struct tr_session * session,
+	const struct burst * burst)
+{
+	if (!tr->nr_batch) tr->batch_start = clock_ns();
+	memcpy(&(tr->batch[tr->nr_batch]), burst, sizeof(struct burst));
+	tr->batch_sessions[tr->nr_batch] = session;
+	if (++tr->nr_batch == tr->batch_max) batch_flush(tr);
+}
+
+/* Tells the handler that a session is gone, with a burst that only
+   names the flow and has no data, and lets go of the session. With a
+   batch handler the close is queued like a burst and the session is
+   kept until the batch is delivered. */
+static void
+session_done(struct trafficker * tr, struct tcp_stream * t,
+	struct tr_session * session, int incomplete)
+{
+	struct burst burst;
+
+	t->user = NULL;
+	tr->open_sessions--;
+
+	memset(&burst, 0, sizeof(struct burst));
+	burst.tr = tr;
+	burst.hash = session->hash;
+	burst.chost = ntohl(t->addr.saddr);
+	burst.dhost = ntohl(t->addr.daddr);
+	burst.cport = ntohs(t->addr.source);
+	burst.dport = ntohs(t->addr.dest);
+	burst.incomplete = incomplete;
+	burst.closed = 1;
+	burst.ts = packet_usec();
+
+	if (!tr->batch_cb) {
+		tr->cb(&burst);
+		session_free(tr, session);
+		return;
+	}
+
+	session->next = tr->closing;
+	tr->closing = session;
+	batch_add(tr, session, &burst);
+}
+
+/* Stops following a session that turned out not to be SSL. libnids
+   drops the stream from the callback once nothing is collected anymore,
+   so no close will be seen for it. */
+static void
+session_reject(struct trafficker * tr, struct tcp_stream * t,
+	struct tr_session * session)
+{
+	size_t bytes = 0;
+
+	if (session->sbuf) bytes += session->sbuf->len;
+	if (session->cbuf) bytes += session->cbuf->len;
+	tr->stats.flows_skipped++;
+	tr->stats.bytes_skipped += bytes;
+	PROBE2(trafficker, flow_skipped, session->hash, bytes);
+
+	t->client.collect--;
+	t->server.collect--;
+
+	session_done(tr, t, session, 1);
+}
+
+static void
+emit_burst(struct trafficker * tr, struct burst * burst)
+{
+	tr->stats.bursts++;
+	burst->ts_emit = clock_ns();
+	PROBE4(trafficker, burst_emitted, burst->hash, burst->client,
+		burst->len, burst->incomplete);
+	if (tr->batch_cb) batch_add(tr, tr->cb_session, burst);
+	else tr->cb(burst);
+}
+
+/* Adds the application data of scanned records to what a direction has
+   pending. */
+static void
+pending_add(struct tr_pending * pending, const struct ssl_record * records,
+	size_t n)
+{
+	size_t i;
+
+	for (i=0;i<n;i++) {
+		if (records[i].type != SSL_MSG_APPLICATION_DATA) continue;
+		pending->len += records[i].len;
+		if (pending->nr_records < BURST_MAX_RECORDS)
+			pending->records[pending->nr_records] = records[i].len;
+		pending->nr_records++;
+	}
+}
+
 static void
 nids_tcp_callback(struct tcp_stream * t, void ** param)
 {
 	struct trafficker * tr = current;
 	struct half_stream hs;
 	struct burst burst;
-	struct ssl_parse sslret;
+	struct ssl_record records[SCAN_RECORDS];
+	struct ssl_scan * scan;
+	struct tr_pending * pending;
 	struct tr_session * session;
-	struct buffer * buf;
-	size_t datalen;
+	struct buffer ** bufp = NULL;
+	struct buffer * buf = NULL;
+	size_t datalen, used, n, i;
 	int incomplete = 0, ret;
+	uint64_t now;
 	char * p;
-	uint32_t hash;
-
-	hash = mkhash(t->addr.saddr, t->addr.source,
-		t->addr.daddr, t->addr.dest);
 
 	switch (t->nids_state) {
 		case NIDS_JUST_EST:
 			t->client.collect++;
 			t->server.collect++;
-			session = malloc(sizeof(struct tr_session));
+			session = session_new(tr);
 			if (!session) return;
-			session->sbuf = buffer_new();
-			session->cbuf = buffer_new();
-			session->first_burst = 1;
-			memset(&(session->last_burst), 0, sizeof(struct burst));
+			/* the hash is only computed once per session */
+			session->hash = mkhash(t->addr.saddr, t->addr.source,
+				t->addr.daddr, t->addr.dest);
+			if (tr->export)
+				session->xflow = export_adopt(tr->export,
+					&(t->addr), session->hash);
 			t->user = session;
+			tr->open_sessions++;
+			tr->stats.flows++;
+			PROBE5(trafficker, flow_established, session->hash,
+				ntohl(t->addr.saddr), ntohl(t->addr.daddr),
+				t->addr.source, t->addr.dest);
 			break;
 		case NIDS_DATA:
 			session = (struct tr_session *)(t->user);
-			burst.hash = hash;
+			if (!session) break;
+			tr->cb_session = session;
+			burst.hash = session->hash;
 			if (t->server.count_new) {
 				hs = t->server;
-				buf = session->sbuf;
+				bufp = &(session->sbuf);
 				burst.client = 1;
 			}
-			else if (t->client.count_new) {
+			else {
+				/* libnids only calls with new data on
+				   one side */
 				hs = t->client;
-				buf = session->cbuf;
+				bufp = &(session->cbuf);
 				burst.client = 0;
 			}
-			buffer_append(buf, hs.data, hs.count_new);
+			tr->stats.bytes_reassembled += hs.count_new;
+			p = hs.data;
+			datalen = hs.count_new;
+
+			/* the first bytes of both directions have to look
+			   like SSL, other sessions aren't reassembled any
+			   further */
+			if (!(session->checked & (1 << burst.client))) {
+				if (!*bufp) *bufp = buffer_new();
+				buf = *bufp;
+				buffer_append(buf, hs.data, hs.count_new);
+				ret = ssl_check(buf->data, buf->len);
+				if (ret < 0) {
+					session_reject(tr, t, session);
+					break;
+				}
+				p = buf->data;
+				datalen = (ret > 0 ? buf->len : 0);
+				if (ret > 0)
+					session->checked |= (1 << burst.client);
+			}
 
-			p = buf->data;
-			datalen = buf->len;
 			burst.len = 0;
 			burst.tr = tr;
 			burst.chost = ntohl(t->addr.saddr);
@@ -154,55 +415,95 @@ nids_tcp_callback(struct tcp_stream * t, void ** param)
 			burst.cport = ntohs(t->addr.source);
 			burst.dport = ntohs(t->addr.dest);
 			burst.incomplete = 0;
-			burst.ts = (tr->live_cap ? time(NULL) :
-				nids_last_pcap_header->ts.tv_sec);
+			now = packet_usec();
+			burst.ts = now;
+			burst.ts_data = clock_ns();
+			burst.ts_emit = 0;
+
+			burst.nr_records = 0;
 
+			/* a joined burst ends when the direction changes or,
+			   with a gap set, when no data came for that long, a
+			   timestamp going backwards is no gap */
 			if (tr->burst_join && !session->first_burst) {
-				if (session->last_burst.client ^ burst.client) {
+				if ((session->last_burst.client ^
+						burst.client) ||
+						(tr->burst_gap &&
+						now > session->last_data &&
+						now - session->last_data >
+						tr->burst_gap)) {
 					if (session->last_burst.len > 0)
-						tr->cb(&(session->last_burst));
+						emit_burst(tr,
+							&(session->last_burst));
 					memcpy(&(session->last_burst), &burst,
 						sizeof(struct burst));
 				}
-				else burst.len = session->last_burst.len;
-			}
-
-			/* XXX: we want to discard this complete session
-			   if it just doesn't look like SSL data at all
-			   (so check this if it's the first data we got
-			   and if it looks like valid SSL).
-			*/
-			while (datalen) {
-				ret = ssl_parse(p, datalen, &sslret);
-				if (ret < 0) break;
-				p += sslret.total_read;
-				datalen -= sslret.total_read;
-				if (sslret.record_type == 23) {
-					burst.len += sslret.data_len;
+				else {
+					burst.len = session->last_burst.len;
+					burst.nr_records =
+						session->last_burst.nr_records;
+					memcpy(burst.records,
+						session->last_burst.records,
+						sizeof(burst.records));
 				}
 			}
+			session->last_data = now;
 
-			/* All buffered SSL data successfully parsed */
-			if (!datalen) {
+			/* the new data is only scanned once, the records
+			   ending in it wait in pending until the direction is
+			   between two records */
+			scan = &(session->scan[burst.client]);
+			pending = &(session->pending[burst.client]);
+			while (datalen && !scan->error) {
+				n = ssl_scan(scan, p, datalen, records,
+					SCAN_RECORDS, &used);
+				p += used;
+				datalen -= used;
+				tr->stats.ssl_records += n;
+				pending_add(pending, records, n);
+			}
+			if (buf && (session->checked & (1 << burst.client))) {
+				buffer_free(buf);
+				*bufp = NULL;
+			}
 
-				burst.ts = (tr->live_cap ? time(NULL) :
-					nids_last_pcap_header->ts.tv_sec);
+			/* All SSL data so far successfully parsed */
+			if ((session->checked & (1 << burst.client)) &&
+					ssl_scan_boundary(scan)) {
+				burst.len += pending->len;
+				for (i=0;i<pending->nr_records &&
+						burst.nr_records + i <
+						BURST_MAX_RECORDS;i++) {
+					burst.records[burst.nr_records + i] =
+						pending->records[i];
+				}
+				burst.nr_records += pending->nr_records;
+				memset(pending, 0, sizeof(struct tr_pending));
 
 				/* Send burst if there's data in the burst and
 				   the burst join option is not set. If the
 				   option is set update the last burst info. */
 				if (burst.len > 0) {
 					if (!(tr->burst_join)) {
-						tr->cb(&burst);
+						emit_burst(tr, &burst);
 					}
 				}
-				if (tr->burst_join) {
+				if (tr->burst_join && session->first_burst) {
+					memcpy(&(session->last_burst), &burst,
+						sizeof(struct burst));
+					session->first_burst = 0;
+				}
+				else if (tr->burst_join) {
 					session->last_burst.len =
 							burst.len;
-					session->first_burst = 0;
+					session->last_burst.nr_records =
+							burst.nr_records;
+					memcpy(session->last_burst.records,
+						burst.records,
+						sizeof(burst.records));
+					session->last_burst.ts_data =
+							burst.ts_data;
 				}
-
-				buffer_reset(buf);
 			}
 			break;
 		case NIDS_EXITING:
@@ -213,6 +514,16 @@ nids_tcp_callback(struct tcp_stream * t, void ** param)
 			session = (struct tr_session *)(t->user);
 	
 			if (!session || !tr) break;
+			tr->cb_session = session;
+
+			if (t->nids_state == NIDS_CLOSE)
+				tr->stats.flows_closed++;
+			else if (t->nids_state == NIDS_RESET)
+				tr->stats.flows_reset++;
+			else if (t->nids_state == NIDS_TIMED_OUT)
+				tr->stats.flows_timed_out++;
+			PROBE3(trafficker, flow_closed, session->hash,
+				t->nids_state, tr->open_sessions);
 
 			/* Send the last buffered burst which might be 
 			   incomplete. */
@@ -220,22 +531,261 @@ nids_tcp_callback(struct tcp_stream * t, void ** param)
 				memcpy(&burst, &(session->last_burst),
 					sizeof(struct burst));
 				burst.incomplete = incomplete;
-				tr->cb(&burst);
+				emit_burst(tr, &burst);
 			}
 
-			buffer_free(session->sbuf);
-			buffer_free(session->cbuf);	
-			free(session);
+			session_done(tr, t, session, incomplete);
 			break;
 	}
+	if (tr) tr->cb_session = NULL;
 }
 
-int
-trafficker_loop(struct trafficker * t, void (*callback)(const struct burst *))
+/* Gets the TCP/IPv4 addresses and ports of a packet the way libnids
+   keeps them for its streams. Returns -1 for anything else. */
+static int
+packet_tuple(int linktype, const u_char * data, uint32_t caplen,
+	struct tuple4 * addr)
 {
-	if (!t || !callback) return -1;
+	uint32_t off, ihl;
+	uint16_t type;
 
-	t->cb = callback;
+	switch (linktype) {
+		case DLT_EN10MB:
+			off = 14;
+			if (caplen < off) return -1;
+			type = (data[12] << 8) | data[13];
+			while (type == 0x8100 && caplen >= off + 4) {
+				type = (data[off + 2] << 8) | data[off + 3];
+				off += 4;
+			}
+			if (type != 0x0800) return -1;
+			break;
+		case DLT_LINUX_SLL:
+			off = 16;
+			if (caplen < off) return -1;
+			type = (data[14] << 8) | data[15];
+			if (type != 0x0800) return -1;
+			break;
+		case DLT_NULL:
+			off = 4;
+			break;
+		case DLT_RAW:
+			off = 0;
+			break;
+		default:
+			return -1;
+	}
+
+	if (caplen < off + 20 || (data[off] >> 4) != 4 || data[off + 9] != 6)
+		return -1;
+	ihl = (data[off] & 0x0f) * 4;
+	if (ihl < 20 || caplen < off + ihl + 4) return -1;
+
+	memcpy(&(addr->saddr), data + off + 12, 4);
+	memcpy(&(addr->daddr), data + off + 16, 4);
+	addr->source = (data[off + ihl] << 8) | data[off + ihl + 1];
+	addr->dest = (data[off + ihl + 2] << 8) | data[off + ihl + 3];
+
+	return 0;
+}
+
+/* Looks up the libnids stream of a packet in both directions. */
+static struct tcp_stream *
+find_stream(struct tuple4 * addr)
+{
+	struct tcp_stream * s;
+	struct tuple4 rev;
+
+	s = nids_find_tcp_stream(addr);
+	if (s) return s;
+
+	rev.saddr = addr->daddr;
+	rev.daddr = addr->saddr;
+	rev.source = addr->dest;
+	rev.dest = addr->source;
+	return nids_find_tcp_stream(&rev);
+}
+
+/* Gets the export flow of a stream, the one of its session once it got
+   established or the one of its handshake. */
+static struct export_flow *
+stream_flow(struct trafficker * t, struct tcp_stream * s, int create)
+{
+	struct tr_session * session;
+
+	session = (struct tr_session *)(s->user);
+	if (session) return session->xflow;
+
+	return export_pending(t->export, &(s->addr), mkhash(s->addr.saddr,
+		s->addr.source, s->addr.daddr, s->addr.dest), create);
+}
+
+/* Passes a packet to libnids and to the export. The packet is queued
+   for the export before libnids sees it, as handling it might close the
+   stream, unless the stream only gets created by this packet. */
+static void
+handle_packet(struct trafficker * t, int linktype,
+	const struct pcap_pkthdr * hdr, const u_char * data)
+{
+	struct export_flow * f = NULL;
+	struct tcp_stream * s;
+	struct tuple4 addr;
+	int tcp = -1;
+
+	/* a batch isn't held back longer than its time limit, as long as
+	   packets keep coming */
+	if (t->nr_batch && clock_ns() - t->batch_start >= t->batch_ns)
+		batch_flush(t);
+
+	/* the packets of flows between other hosts never get to libnids,
+	   so it doesn't keep state for them */
+	if (t->servers) {
+		tcp = (packet_tuple(linktype, data, hdr->caplen, &addr) == 0);
+		if (!tcp || (lpm_lookup(t->servers, ntohl(addr.saddr)) < 0 &&
+				lpm_lookup(t->servers,
+				ntohl(addr.daddr)) < 0)) {
+			t->stats.packets_skipped++;
+			return;
+		}
+	}
+
+	t->stats.packets++;
+	if (!t->export) {
+		nids_pcap_handler(NULL, (struct pcap_pkthdr *)hdr,
+			(u_char *)data);
+		return;
+	}
+
+	if (tcp < 0)
+		tcp = (packet_tuple(linktype, data, hdr->caplen, &addr) == 0);
+	if (tcp && (s = find_stream(&addr)) != NULL) {
+		f = stream_flow(t, s, 0);
+		if (f) export_packet(t->export, f, hdr, data);
+	}
+
+	nids_pcap_handler(NULL, (struct pcap_pkthdr *)hdr, (u_char *)data);
+
+	if (tcp && !f && (s = find_stream(&addr)) != NULL) {
+		f = stream_flow(t, s, 1);
+		if (f) export_packet(t->export, f, hdr, data);
+	}
+}
+
+static void
+pcap_callback(u_char * arg, const struct pcap_pkthdr * hdr,
+	const u_char * data)
+{
+	struct trafficker * t = (struct trafficker *)arg;
+
+	handle_packet(t, pcap_datalink(t->pcap), hdr, data);
+}
+
+/* Feeds the packets of a mapped capture file to libnids. The packet data
+   is passed straight from the mapping, only the header is rebuilt since
+   the timestamps in the file can have any resolution. For a tail file
+   only packets of streams libnids already knows about are passed on and
+   it stops as soon as all sessions are gone or went idle. */
+static void
+file_loop(struct trafficker * t, struct pcapfile * pf, int tail)
+{
+	struct pcapfile_pkt pkt;
+	struct pcap_pkthdr hdr;
+	struct tuple4 addr;
+	int linktype;
+
+	linktype = pcapfile_linktype(t->file);
+	if (pcapfile_linktype(pf) != linktype) return;
+
+	while (t->loop && pcapfile_next(pf, &pkt) > 0) {
+		/* libnids only knows about a single link type */
+		if (pkt.linktype != linktype) continue;
+
+		hdr.ts.tv_sec = pkt.ts_nsec / 1000000000ULL;
+		hdr.ts.tv_usec = (pkt.ts_nsec % 1000000000ULL) / 1000;
+		hdr.caplen = pkt.caplen;
+		hdr.len = pkt.len;
+
+		if (tail) {
+			if (!t->open_sessions || hdr.ts.tv_sec >
+					t->last_ts + TAIL_IDLE_TIMEOUT) {
+				t->loop = 0;
+				break;
+			}
+			if (packet_tuple(linktype, pkt.data, pkt.caplen,
+					&addr) < 0 || !find_stream(&addr))
+				continue;
+		}
+
+		if (t->have_filter && !pcap_offline_filter(&(t->filter),
+				&hdr, pkt.data))
+			continue;
+
+		t->last_ts = hdr.ts.tv_sec;
+		handle_packet(t, linktype, &hdr, pkt.data);
+	}
+}
+
+/* Follows the sessions which are still open at the end of the capture
+   into the tail files. */
+static void
+tail_loop(struct trafficker * t)
+{
+	struct pcapfile * pf;
+	int i;
+
+	if (!t->file || !t->open_sessions) return;
+
+	for (i=0;i<t->nr_tails && t->loop;i++) {
+		pf = pcapfile_open(t->tails[i]);
+		if (!pf) break;
+		file_loop(t, pf, 1);
+		pcapfile_close(pf);
+	}
+}
+
+/* Reads a live capture in batch mode. A batch has to go out within its
+   time limit even when no more packets come in, so the capture is read
+   without blocking and waited for with poll() at most until the oldest
+   burst of the batch is due. */
+static void
+live_loop(struct trafficker * t)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	struct pollfd pfd;
+	uint64_t now, due;
+	int timeout;
+
+	pfd.fd = pcap_get_selectable_fd(t->pcap);
+	pfd.events = POLLIN;
+	if (pfd.fd < 0 || pcap_setnonblock(t->pcap, 1, errbuf) < 0) {
+		pcap_loop(t->pcap, -1, pcap_callback, (u_char *)t);
+		return;
+	}
+
+	while (t->loop) {
+		timeout = -1;
+		if (t->nr_batch) {
+			now = clock_ns();
+			due = t->batch_start + t->batch_ns;
+			if (now >= due) {
+				batch_flush(t);
+				continue;
+			}
+			timeout = (due - now + 999999) / 1000000;
+		}
+		if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) break;
+		if (!t->loop) break;
+		if (pcap_dispatch(t->pcap, -1, pcap_callback,
+				(u_char *)t) < 0)
+			break;
+	}
+
+	pcap_setnonblock(t->pcap, 0, errbuf);
+}
+
+static void
+loop_run(struct trafficker * t)
+{
 	t->loop = 1;
 	current = t;
 
@@ -243,8 +793,77 @@ trafficker_loop(struct trafficker * t, void (*callback)(const struct burst *))
 	nids_params.pcap_desc = t->pcap;
 	nids_init();
 	nids_register_tcp(nids_tcp_callback);
-	pcap_loop(t->pcap, -1, (pcap_handler)nids_pcap_handler, NULL); 
+	if (t->file) {
+		file_loop(t, t->file, 0);
+		tail_loop(t);
+	}
+	else if (t->batch_cb) live_loop(t);
+	else pcap_loop(t->pcap, -1, pcap_callback, (u_char *)t);
 	nids_exit();
+}
+
+/* Reads the capture and hands every burst to the callback. When a
+   session is gone, closed, reset, timed out, not SSL or still open when
+   the capture ends, a last burst with closed set follows for it, so
+   whatever is kept per flow can be let go of then. */
+int
+trafficker_loop(struct trafficker * t, void (*callback)(const struct burst *))
+{
+	if (!t || !callback) return -1;
+
+	t->cb = callback;
+	loop_run(t);
+
+	return 0;
+}
+
+/* Like trafficker_loop() but the bursts are handed over in arrays of up
+   to max_bursts, a batch is delivered once it is full or its oldest
+   burst waited max_usec microseconds. Reading a live capture the limit
+   holds when no packets come in as well, reading a file it's checked as
+   the packets are read. The closes of sessions are part of the batches
+   the same way. Whatever is left is delivered when the loop ends, after
+   trafficker_breakloop() as well. */
+int
+trafficker_loop_batch(struct trafficker * t, traffick_batch_handler handler,
+	size_t max_bursts, uint32_t max_usec)
+{
+	if (!t || !handler || !max_bursts) return -1;
+
+	t->batch = malloc(sizeof(struct burst) * max_bursts);
+	t->batch_sessions = malloc(sizeof(struct tr_session *) * max_bursts);
+	if (!t->batch || !t->batch_sessions) {
+		free(t->batch);
+		free(t->batch_sessions);
+		t->batch = NULL;
+		t->batch_sessions = NULL;
+		return -1;
+	}
+
+	t->batch_cb = handler;
+	t->batch_max = max_bursts;
+	t->batch_ns = (uint64_t)max_usec * 1000;
+	t->nr_batch = 0;
+	loop_run(t);
+	batch_flush(t);
+
+	t->batch_cb = NULL;
+	free(t->batch);
+	free(t->batch_sessions);
+	t->batch = NULL;
+	t->batch_sessions = NULL;
+
+	return 0;
+}
+
+/* Delivers the bursts queued for the batch handler right away. It can't
+   be called from the batch handler itself or from a signal handler. */
+int
+trafficker_flush(struct trafficker * t)
+{
+	if (!t || !t->batch_cb || t->flushing) return -1;
+
+	batch_flush(t);
 
 	return 0;
 }
@@ -260,16 +879,124 @@ trafficker_breakloop(struct trafficker * t)
 	return 0;
 }
 
+/* Adds a capture file that follows the one being read. When the capture
+   ends the sessions still open are followed into the tail files until
+   they are closed, so a set of consecutive files can be read in
+   parallel with every session being handled by exactly one reader: the
+   one of the file where it started. Only files pcapfile can read are
+   supported. */
+int
+trafficker_add_tail(struct trafficker * t, const char * fname)
+{
+	char ** tails;
+
+	if (!t || !fname || !t->file) return -1;
+
+	tails = realloc(t->tails, sizeof(char *) * (t->nr_tails + 1));
+	if (!tails) return -1;
+	t->tails = tails;
+
+	t->tails[t->nr_tails] = strdup(fname);
+	if (!t->tails[t->nr_tails]) return -1;
+	t->nr_tails++;
+
+	return 0;
+}
+
 void
 trafficker_close(struct trafficker * t)
 {
+	struct tr_slab * slab;
+	int i;
+
 	if (!t) return;
 
+	while (t->slabs) {
+		slab = t->slabs;
+		t->slabs = slab->next;
+		free(slab);
+	}
+
+	for (i=0;i<t->nr_tails;i++) free(t->tails[i]);
+	free(t->tails);
+
+	export_close(t->export);
+	lpm_free(t->servers);
+	if (t->have_filter) pcap_freecode(&(t->filter));
+	if (t->file) pcapfile_close(t->file);
 	pcap_close(t->pcap);
 	current = NULL;
 	free(t);
 }
 
+/* Writes the packets of the flows passed to trafficker_flow_keep() to a
+   capture file, all other packets are left out. Packets are held back
+   until their flow is decided on. */
+int
+trafficker_set_export(struct trafficker * t, const char * fname)
+{
+	if (!t || !fname || t->export || t->loop) return -1;
+
+	t->export = export_open(t->pcap, fname);
+	if (!t->export) return -1;
+
+	return 0;
+}
+
+/* Keeps the flow of a burst in the export, this has to be called from
+   the burst or batch handler while the burst is being handled. */
+int
+trafficker_flow_keep(struct trafficker * t, const struct burst * b)
+{
+	struct tr_session * session;
+
+	if (!t || !b || !t->export) return -1;
+
+	/* bursts of a batch are looked up by their place in it */
+	session = t->cb_session;
+	if (t->flushing && b >= t->batch && b < t->batch + t->nr_batch)
+		session = t->batch_sessions[b - t->batch];
+	if (!session || !session->xflow || session->hash != b->hash)
+		return -1;
+
+	export_decide(t->export, session->xflow, 1);
+	return 0;
+}
+
+/* Gets the counters of the capture so far, with the drops of a live
+   capture from libpcap. pcap_stats() isn't async-signal-safe and the
+   counters are updated as the packets are read, so it is to be called
+   from the handlers or after the loop, not from a signal handler. */
+int
+trafficker_get_stats(struct trafficker * t, struct trafficker_stats * st)
+{
+	struct pcap_stat ps;
+
+	if (!t || !st) return -1;
+
+	memset(st, 0, sizeof(struct trafficker_stats));
+	st->packets = t->stats.packets;
+	st->packets_skipped = t->stats.packets_skipped;
+	st->flows = t->stats.flows;
+	st->flows_closed = t->stats.flows_closed;
+	st->flows_reset = t->stats.flows_reset;
+	st->flows_timed_out = t->stats.flows_timed_out;
+	st->flows_skipped = t->stats.flows_skipped;
+	st->sessions_open = t->open_sessions;
+	st->bytes_reassembled = t->stats.bytes_reassembled;
+	st->bytes_skipped = t->stats.bytes_skipped;
+	st->ssl_records = t->stats.ssl_records;
+	st->bursts = t->stats.bursts;
+
+	if (t->live_cap && !pcap_stats(t->pcap, &ps)) {
+		st->pcap_received = ps.ps_recv;
+		st->pcap_dropped = ps.ps_drop;
+		st->pcap_ifdropped = ps.ps_ifdrop;
+	}
+
+	return 0;
+}
+
 int
 trafficker_set_burstjoin(struct trafficker * t, int join)
 {
@@ -290,4 +1017,47 @@ trafficker_get_burstjoin(struct trafficker * t, int * join)
 	return 0;
 }
 
+/* Also ends a joined burst when its direction had no data for usec
+   microseconds of capture time, 0 turns it off. Responses to requests
+   that went out back to back on a connection are split up this way. */
+int
+trafficker_set_burstgap(struct trafficker * t, uint32_t usec)
+{
+	if (!t) return -1;
+
+	t->burst_gap = usec;
+
+	return 0;
+}
+
+int
+trafficker_get_burstgap(struct trafficker * t, uint32_t * usec)
+{
+	if (!t || !usec) return -1;
+
+	*usec = t->burst_gap;
+
+	return 0;
+}
+
+/* Only follows the flows with one end in the prefix of prefixlen bits of
+   addr, in host byte order, or in one of the other prefixes added. The
+   packets are matched against all prefixes at once, so the capture
+   filter can stay as simple as "tcp port 443" however many servers
+   there are. Prefixes can also be added from the handlers while the
+   capture runs, they apply to the next packets. */
+int
+trafficker_add_server(struct trafficker * t, uint32_t addr,
+	uint32_t prefixlen)
+{
+	if (!t || prefixlen > 32) return -1;
+
+	if (!t->servers) {
+		t->servers = lpm_new();
+		if (!t->servers) return -1;
+	}
+
+	return lpm_add(t->servers, addr, prefixlen);
+}
+
 /* EOF */
@@ -7,21 +7,60 @@
 
 struct trafficker;
 
+/* bursts carry the lengths of this many of their records */
+#define BURST_MAX_RECORDS	16
+
 struct burst {
 	struct trafficker * tr;
-	uint32_t hash;
+	uint64_t hash;
 	uint32_t id;
 	size_t len;
+	/* number of SSL application data records in the burst and the
+	   lengths of the first BURST_MAX_RECORDS of them */
+	uint32_t nr_records;
+	uint16_t records[BURST_MAX_RECORDS];
 	int client;
 	int incomplete;
+	/* the flow is gone, this burst has no data, it is the last one
+	   the handler gets for the flow */
+	int closed;
 	uint32_t chost;
 	uint16_t cport;
 	uint32_t dhost;
 	uint16_t dport;
-	time_t ts;
+	/* capture time of the burst in microseconds since the epoch, taken
+	   from the packets, joined bursts have the time of their start */
+	uint64_t ts;
+	/* CLOCK_MONOTONIC nanoseconds when the last data of the burst was
+	   reassembled and when the burst was handed to the handler */
+	uint64_t ts_data;
+	uint64_t ts_emit;
+};
+
+/* Counters of a capture, they only ever go up except sessions_open. The
+   pcap_* ones are the kernel counters of a live capture. */
+struct trafficker_stats {
+	uint64_t packets;
+	/* packets of hosts not added with trafficker_add_server(), they
+	   are not part of packets */
+	uint64_t packets_skipped;
+	uint64_t pcap_received;
+	uint64_t pcap_dropped;
+	uint64_t pcap_ifdropped;
+	uint64_t flows;
+	uint64_t flows_closed;
+	uint64_t flows_reset;
+	uint64_t flows_timed_out;
+	uint64_t flows_skipped;
+	uint64_t sessions_open;
+	uint64_t bytes_reassembled;
+	uint64_t bytes_skipped;
+	uint64_t ssl_records;
+	uint64_t bursts;
 };
 
 typedef void (*traffick_handler)(const struct burst *);
+typedef void (*traffick_batch_handler)(const struct burst *, size_t);
 
 struct trafficker * trafficker_open_offline(
 	const char * fname, const char * filter);
@@ -29,9 +68,21 @@ struct trafficker * trafficker_open_online(
 	const char * device, const char * filter);
 void trafficker_close(struct trafficker * t);
 int trafficker_loop(struct trafficker * t, traffick_handler);
+int trafficker_loop_batch(struct trafficker * t, traffick_batch_handler,
+	size_t max_bursts, uint32_t max_usec);
+int trafficker_flush(struct trafficker * t);
 int trafficker_breakloop(struct trafficker * t);
+int trafficker_add_tail(struct trafficker * t, const char * fname);
+int trafficker_set_export(struct trafficker * t, const char * fname);
+int trafficker_flow_keep(struct trafficker * t, const struct burst * b);
+int trafficker_get_stats(struct trafficker * t,
+	struct trafficker_stats * st);
 int trafficker_set_burstjoin(struct trafficker * t, int);
 int trafficker_get_burstjoin(struct trafficker * t, int *);
+int trafficker_set_burstgap(struct trafficker * t, uint32_t);
+int trafficker_get_burstgap(struct trafficker * t, uint32_t *);
+int trafficker_add_server(struct trafficker * t, uint32_t addr,
+	uint32_t prefixlen);
 
 #endif
 
@@ -0,0 +1,137 @@
+/* lpm.c */
+
+/* Longest prefix match of IPv4 addresses, laid out as DIR-24-8. The top
+   24 bits of an address index a table with an entry for every /24. The
+   entry holds the length of the longest prefix covering the whole /24,
+   or the index of a group of 256 entries for the last 8 bits when
+   longer prefixes cut into that /24. A lookup is one or two loads
+   whatever the number of prefixes. The lengths are stored plus one so
+   that 0 means no prefix. The table of /24s takes 32MB of address space,
+   it's allocated zeroed so only the pages prefixes fall into get
+   touched. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lpm.h"
+
+struct lpm *
+lpm_new()
+{
+	struct lpm * l;
+
+	l = malloc(sizeof(struct lpm));
+	if (!l) return NULL;
+
+	memset(l, 0, sizeof(struct lpm));
+	l->tbl24 = calloc(LPM_TBL24_SIZE, sizeof(uint16_t));
+	if (!l->tbl24) {
+		free(l);
+		return NULL;
+	}
+
+	return l;
+}
+
+void
+lpm_free(struct lpm * l)
+{
+	if (!l) return;
+
+	free(l->tbl24);
+	free(l->tbl8);
+	free(l);
+}
+
+/* Returns the index of a new group of 256 entries all set to value, or
+   -1 if it cannot be allocated. */
+static int
+group_new(struct lpm * l, uint8_t value)
+{
+	uint32_t alloc;
+	uint8_t * p;
+
+	if (l->nr_groups == LPM_MAX_GROUPS) return -1;
+	if (l->nr_groups == l->alloc_groups) {
+		alloc = (l->alloc_groups ? l->alloc_groups * 2 : 16);
+		if (alloc > LPM_MAX_GROUPS) alloc = LPM_MAX_GROUPS;
+		p = realloc(l->tbl8, (size_t)alloc * 256);
+		if (!p) return -1;
+		l->tbl8 = p;
+		l->alloc_groups = alloc;
+	}
+
+	memset(l->tbl8 + (size_t)l->nr_groups * 256, value, 256);
+	return l->nr_groups++;
+}
+
+/* Adds the prefix of len bits of addr, in host byte order. Entries only
+   get overwritten by prefixes at least as long as theirs, so prefixes
+   can be added in any order. Returns -1 on error. */
+int
+lpm_add(struct lpm * l, uint32_t addr, uint32_t len)
+{
+	uint32_t i, j, first, last;
+	uint8_t value, * group;
+	uint16_t e;
+	int g;
+
+	if (!l || len > 32) return -1;
+
+	if (len) addr &= 0xffffffff << (32 - len);
+	else addr = 0;
+	value = len + 1;
+
+	if (len <= 24) {
+		first = addr >> 8;
+		last = first + (1 << (24 - len)) - 1;
+		for (i=first;i<=last;i++) {
+			e = l->tbl24[i];
+			if (!(e & LPM_EXTENDED)) {
+				if (e <= value) l->tbl24[i] = value;
+				continue;
+			}
+			group = l->tbl8 + (size_t)(e & ~LPM_EXTENDED) * 256;
+			for (j=0;j<256;j++) {
+				if (group[j] <= value) group[j] = value;
+			}
+		}
+	}
+	else {
+		i = addr >> 8;
+		e = l->tbl24[i];
+		if (!(e & LPM_EXTENDED)) {
+			g = group_new(l, e);
+			if (g < 0) return -1;
+			e = LPM_EXTENDED | g;
+			l->tbl24[i] = e;
+		}
+		group = l->tbl8 + (size_t)(e & ~LPM_EXTENDED) * 256;
+		first = addr & 0xff;
+		last = first + (1 << (32 - len)) - 1;
+		for (j=first;j<=last;j++) {
+			if (group[j] <= value) group[j] = value;
+		}
+	}
+
+	l->nr_prefixes++;
+	return 0;
+}
+
+/* Returns the length of the longest prefix addr, in host byte order, is
+   in or -1 if it's in none. */
+int
+lpm_lookup(const struct lpm * l, uint32_t addr)
+{
+	uint16_t e;
+
+	e = l->tbl24[addr >> 8];
+	if (e & LPM_EXTENDED) {
+		e = l->tbl8[(size_t)(e & ~LPM_EXTENDED) * 256 +
+			(addr & 0xff)];
+	}
+
+	return (int)e - 1;
+}
+
+/* EOF */
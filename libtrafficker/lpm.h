@@ -0,0 +1,29 @@
+/* lpm.h */
+
+#ifndef LPM_H
+  #define LPM_H
+
+#include <stdint.h>
+
+/* entries of the table of /24s with this bit set point to a group of 256
+   entries for the last 8 bits of the address */
+#define LPM_TBL24_SIZE		(1 << 24)
+#define LPM_EXTENDED		0x8000
+#define LPM_MAX_GROUPS		0x8000
+
+struct lpm {
+	uint16_t * tbl24;
+	uint8_t * tbl8;
+	uint32_t nr_groups;
+	uint32_t alloc_groups;
+	uint32_t nr_prefixes;
+};
+
+struct lpm * lpm_new();
+void lpm_free(struct lpm *);
+int lpm_add(struct lpm *, uint32_t, uint32_t);
+int lpm_lookup(const struct lpm *, uint32_t);
+
+#endif
+
+/* EOF */
@@ -0,0 +1,515 @@
+/* pcapfile.c */
+
+/* Reader for classic pcap and pcapng capture files. The file is mapped
+   into memory and parsed in place so packets can be handed on without
+   copying them or doing any system calls per packet. Classic pcap is
+   accepted in both byte orders with microsecond or nanosecond
+   timestamps as well as the modified format with the longer record
+   headers, pcapng files can hold several sections and interfaces.
+   Compressed files are decompressed by a reader thread, see zstream.c,
+   and parsed one block of whole records at a time. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcapfile.h"
+#include "zstream.h"
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAP_MAGIC_MODIFIED	0xa1b2cd34
+
+#define PCAPNG_SHB		0x0a0d0d0a
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_PB		0x00000002
+#define PCAPNG_SPB		0x00000003
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER	0x1a2b3c4d
+
+#define PCAPNG_OPT_END		0
+#define PCAPNG_OPT_TSRESOL	9
+#define PCAPNG_OPT_TSOFFSET	14
+
+#define PCAP_HDR_LEN		24
+#define PCAP_REC_LEN		16
+#define PCAP_REC_MODIFIED_LEN	24
+
+/* consumed parts of the mapping are unmapped and evicted from the page
+   cache in steps of this size so replaying large captures doesn't fill
+   it */
+#define DROP_CHUNK		(64 * 1024 * 1024)
+
+struct pcapfile_iface {
+	int linktype;
+	uint32_t snaplen;
+	int tsbinary;
+	uint8_t tsexp;
+	int64_t tsoffset;
+};
+
+/* what the reader thread needs to know to cut the decompressed data
+   at record boundaries */
+struct pcapfile_split {
+	int started;
+	int ng;
+	int swap;
+	size_t reclen;
+};
+
+struct pcapfile {
+	int fd;
+	const unsigned char * map;
+	size_t size;
+	size_t off;
+	size_t dropped;
+	int ng;
+	int swap;
+
+	/* compressed files */
+	struct zstream * z;
+	struct pcapfile_split split;
+
+	/* classic pcap */
+	int nsec;
+	size_t reclen;
+	int linktype;
+	uint32_t snaplen;
+
+	/* pcapng */
+	struct pcapfile_iface * ifaces;
+	uint32_t nr_ifaces;
+	uint64_t last_ts;
+};
+
+static inline uint16_t
+rd16(struct pcapfile * pf, size_t off)
+{
+	uint16_t v;
+
+	memcpy(&v, pf->map + off, sizeof(v));
+	return (pf->swap ? __builtin_bswap16(v) : v);
+}
+
+static inline uint32_t
+rd32(struct pcapfile * pf, size_t off)
+{
+	uint32_t v;
+
+	memcpy(&v, pf->map + off, sizeof(v));
+	return (pf->swap ? __builtin_bswap32(v) : v);
+}
+
+static inline uint64_t
+rd64(struct pcapfile * pf, size_t off)
+{
+	uint64_t v;
+
+	memcpy(&v, pf->map + off, sizeof(v));
+	return (pf->swap ? __builtin_bswap64(v) : v);
+}
+
+/* Returns 1 if there are at least n more bytes at the current offset.
+   For a compressed file the next block is fetched once the current one
+   is used up, records never cross blocks. */
+static int
+pcapfile_avail(struct pcapfile * pf, size_t n)
+{
+	const unsigned char * data;
+	size_t len;
+
+	if (pf->off + n <= pf->size) return 1;
+	if (!pf->z || pf->off < pf->size) return 0;
+
+	if (zstream_next(pf->z, &data, &len) <= 0) return 0;
+	pf->map = data;
+	pf->size = len;
+	pf->off = 0;
+
+	return (n <= len);
+}
+
+static inline uint32_t
+split32(struct pcapfile_split * sp, const unsigned char * p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return (sp->swap ? __builtin_bswap32(v) : v);
+}
+
+/* Runs in the reader thread of a compressed file and returns the length
+   of the whole records at the start of data. */
+static size_t
+pcapfile_split(void * arg, const unsigned char * data, size_t len)
+{
+	struct pcapfile_split * sp = arg;
+	uint32_t magic, blen, caplen;
+	size_t off = 0;
+
+	if (!sp->started) {
+		if (len < PCAP_HDR_LEN) return 0;
+		memcpy(&magic, data, sizeof(magic));
+		if (magic == PCAPNG_SHB) sp->ng = 1;
+		else {
+			sp->swap = (magic == __builtin_bswap32(PCAP_MAGIC) ||
+				magic == __builtin_bswap32(PCAP_MAGIC_NSEC) ||
+				magic == __builtin_bswap32(PCAP_MAGIC_MODIFIED));
+			magic = split32(sp, data);
+			sp->reclen = (magic == PCAP_MAGIC_MODIFIED ?
+				PCAP_REC_MODIFIED_LEN : PCAP_REC_LEN);
+			off = PCAP_HDR_LEN;
+		}
+		sp->started = 1;
+	}
+
+	while (1) {
+		if (!sp->ng) {
+			if (off + sp->reclen > len) break;
+			caplen = split32(sp, data + off + 8);
+			if (caplen > len - off - sp->reclen) break;
+			off += sp->reclen + caplen;
+			continue;
+		}
+
+		if (off + 12 > len) break;
+		memcpy(&magic, data + off, sizeof(magic));
+		if (magic == PCAPNG_SHB) {
+			memcpy(&magic, data + off + 8, sizeof(magic));
+			sp->swap = (magic != PCAPNG_BYTE_ORDER);
+		}
+		blen = split32(sp, data + off + 4);
+
+		/* let the parser stop at a broken block */
+		if (blen < 12) return len;
+		if (blen > len - off) break;
+		off += blen;
+	}
+
+	return off;
+}
+
+/* Converts a timestamp in units of the interface's resolution to
+   nanoseconds. */
+static uint64_t
+iface_ts(struct pcapfile_iface * iface, uint64_t ts)
+{
+	uint64_t ns;
+	uint8_t i, e;
+
+	if (iface->tsbinary) {
+		e = iface->tsexp;
+		if (e > 32) {
+			ts >>= (e - 32);
+			e = 32;
+		}
+		ns = (ts >> e) * 1000000000ULL +
+			(((ts & ((1ULL << e) - 1)) * 1000000000ULL) >> e);
+	}
+	else if (iface->tsexp <= 9) {
+		ns = ts;
+		for (i=iface->tsexp;i<9;i++) ns *= 10;
+	}
+	else {
+		ns = ts;
+		for (i=9;i<iface->tsexp && ns;i++) ns /= 10;
+	}
+
+	return ns + iface->tsoffset * 1000000000LL;
+}
+
+static int
+pcapng_add_iface(struct pcapfile * pf, size_t off, size_t len)
+{
+	struct pcapfile_iface * ifaces, * iface;
+	size_t o, end;
+	uint16_t code, olen;
+	uint8_t v;
+
+	if (len < 20) return -1;
+
+	ifaces = realloc(pf->ifaces,
+		sizeof(struct pcapfile_iface) * (pf->nr_ifaces + 1));
+	if (!ifaces) return -1;
+	pf->ifaces = ifaces;
+	iface = &(ifaces[pf->nr_ifaces++]);
+
+	iface->linktype = rd16(pf, off + 8);
+	iface->snaplen = rd32(pf, off + 12);
+	iface->tsbinary = 0;
+	iface->tsexp = 6;
+	iface->tsoffset = 0;
+
+	o = off + 16;
+	end = off + len - 4;
+	while (o + 4 <= end) {
+		code = rd16(pf, o);
+		olen = rd16(pf, o + 2);
+		o += 4;
+		if (code == PCAPNG_OPT_END || o + olen > end) break;
+		if (code == PCAPNG_OPT_TSRESOL && olen >= 1) {
+			v = pf->map[o];
+			iface->tsbinary = (v & 0x80) != 0;
+			iface->tsexp = v & 0x7f;
+		}
+		else if (code == PCAPNG_OPT_TSOFFSET && olen >= 8) {
+			iface->tsoffset = (int64_t)rd64(pf, o);
+		}
+		o += (olen + 3) & ~3;
+	}
+
+	return 0;
+}
+
+/* Handles the pcapng block at the current offset. Returns 1 if it was a
+   packet, 0 for any other block and -1 at the end of the file. A block
+   which is cut off counts as the end of the file. */
+static int
+pcapng_block(struct pcapfile * pf, struct pcapfile_pkt * pkt)
+{
+	struct pcapfile_iface * iface;
+	uint32_t type, len, idx;
+	uint64_t ts;
+	size_t off;
+
+	if (!pcapfile_avail(pf, 12)) return -1;
+	off = pf->off;
+
+	memcpy(&type, pf->map + off, sizeof(type));
+	if (type == PCAPNG_SHB) {
+		/* every section sets its own byte order and interfaces */
+		memcpy(&idx, pf->map + off + 8, sizeof(idx));
+		if (idx == PCAPNG_BYTE_ORDER) pf->swap = 0;
+		else if (idx == __builtin_bswap32(PCAPNG_BYTE_ORDER))
+			pf->swap = 1;
+		else return -1;
+		pf->nr_ifaces = 0;
+	}
+	else type = rd32(pf, off);
+
+	len = rd32(pf, off + 4);
+	if (len < 12 || (len & 3) || len > pf->size - off) return -1;
+	pf->off += len;
+
+	switch (type) {
+		case PCAPNG_IDB:
+			if (pcapng_add_iface(pf, off, len) < 0) return -1;
+			return 0;
+		case PCAPNG_EPB:
+			if (len < 32) return 0;
+			idx = rd32(pf, off + 8);
+			ts = ((uint64_t)rd32(pf, off + 12) << 32) |
+				rd32(pf, off + 16);
+			pkt->caplen = rd32(pf, off + 20);
+			pkt->len = rd32(pf, off + 24);
+			pkt->data = pf->map + off + 28;
+			if (pkt->caplen > len - 32) return 0;
+			break;
+		case PCAPNG_PB:
+			if (len < 32) return 0;
+			idx = rd16(pf, off + 8);
+			ts = ((uint64_t)rd32(pf, off + 12) << 32) |
+				rd32(pf, off + 16);
+			pkt->caplen = rd32(pf, off + 20);
+			pkt->len = rd32(pf, off + 24);
+			pkt->data = pf->map + off + 28;
+			if (pkt->caplen > len - 32) return 0;
+			break;
+		case PCAPNG_SPB:
+			if (len < 16 || !pf->nr_ifaces) return 0;
+			idx = 0;
+			pkt->len = rd32(pf, off + 8);
+			pkt->caplen = pkt->len;
+			if (pkt->caplen > len - 16) pkt->caplen = len - 16;
+			if (pf->ifaces[0].snaplen &&
+					pkt->caplen > pf->ifaces[0].snaplen)
+				pkt->caplen = pf->ifaces[0].snaplen;
+			pkt->data = pf->map + off + 12;
+
+			/* simple packet blocks carry no timestamp */
+			pkt->ts_nsec = pf->last_ts;
+			pkt->linktype = pf->ifaces[0].linktype;
+			return 1;
+		default:
+			return 0;
+	}
+
+	if (idx >= pf->nr_ifaces) return 0;
+	iface = &(pf->ifaces[idx]);
+	pkt->ts_nsec = iface_ts(iface, ts);
+	pkt->linktype = iface->linktype;
+	pf->last_ts = pkt->ts_nsec;
+
+	return 1;
+}
+
+static int
+pcap_record(struct pcapfile * pf, struct pcapfile_pkt * pkt)
+{
+	uint32_t sec, frac;
+	size_t off;
+
+	if (!pcapfile_avail(pf, pf->reclen)) return -1;
+	off = pf->off;
+
+	sec = rd32(pf, off);
+	frac = rd32(pf, off + 4);
+	pkt->caplen = rd32(pf, off + 8);
+	pkt->len = rd32(pf, off + 12);
+	if (pkt->caplen > pf->size - off - pf->reclen) return -1;
+
+	pkt->ts_nsec = (uint64_t)sec * 1000000000ULL +
+		(pf->nsec ? frac : (uint64_t)frac * 1000);
+	pkt->linktype = pf->linktype;
+	pkt->data = pf->map + off + pf->reclen;
+	pf->off += pf->reclen + pkt->caplen;
+
+	return 1;
+}
+
+struct pcapfile *
+pcapfile_open(const char * fname)
+{
+	struct pcapfile * pf;
+	struct stat st;
+	unsigned char head[4];
+	uint32_t magic;
+	void * map;
+	int fd, type;
+
+	if (!fname) return NULL;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	pf = malloc(sizeof(struct pcapfile));
+	if (!pf) {
+		close(fd);
+		return NULL;
+	}
+	memset(pf, 0, sizeof(struct pcapfile));
+	pf->fd = fd;
+
+	if (fstat(fd, &st) < 0 || pread(fd, head, sizeof(head), 0) !=
+			sizeof(head))
+		goto fail;
+
+	type = zstream_detect(head, sizeof(head));
+	if (type != ZSTREAM_NONE) {
+		pf->z = zstream_open(fd, type, pcapfile_split, &(pf->split));
+		if (!pf->z || !pcapfile_avail(pf, PCAP_HDR_LEN)) goto fail;
+	}
+	else {
+		/* files which don't fit into the address space are left to
+		   libpcap */
+		if (st.st_size < PCAP_HDR_LEN ||
+				(uint64_t)st.st_size > SIZE_MAX)
+			goto fail;
+
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) goto fail;
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		pf->map = map;
+		pf->size = st.st_size;
+	}
+
+	memcpy(&magic, pf->map, sizeof(magic));
+	if (magic == PCAPNG_SHB) {
+		pf->ng = 1;
+
+		/* get the interfaces of the first section, the link type of
+		   the first one is the one of the whole file */
+		while (pcapfile_avail(pf, 12)) {
+			magic = rd32(pf, pf->off);
+			if (magic == PCAPNG_EPB || magic == PCAPNG_PB ||
+					magic == PCAPNG_SPB)
+				break;
+			if (pcapng_block(pf, NULL) < 0) break;
+		}
+		if (!pf->nr_ifaces) goto fail;
+		pf->linktype = pf->ifaces[0].linktype;
+		pf->snaplen = pf->ifaces[0].snaplen;
+
+		return pf;
+	}
+
+	pf->swap = (magic == __builtin_bswap32(PCAP_MAGIC) ||
+		magic == __builtin_bswap32(PCAP_MAGIC_NSEC) ||
+		magic == __builtin_bswap32(PCAP_MAGIC_MODIFIED));
+	magic = rd32(pf, 0);
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC &&
+			magic != PCAP_MAGIC_MODIFIED)
+		goto fail;
+
+	pf->nsec = (magic == PCAP_MAGIC_NSEC);
+	pf->reclen = (magic == PCAP_MAGIC_MODIFIED ?
+		PCAP_REC_MODIFIED_LEN : PCAP_REC_LEN);
+	pf->snaplen = rd32(pf, 16);
+	pf->linktype = rd32(pf, 20) & 0x0fffffff;
+	pf->off = PCAP_HDR_LEN;
+
+	return pf;
+
+fail:
+	pcapfile_close(pf);
+	return NULL;
+}
+
+int
+pcapfile_linktype(struct pcapfile * pf)
+{
+	if (!pf) return -1;
+	return pf->linktype;
+}
+
+int
+pcapfile_snaplen(struct pcapfile * pf)
+{
+	if (!pf) return -1;
+	return (pf->snaplen ? pf->snaplen : 65535);
+}
+
+/* Gets the next packet. Returns 1 if there was one, 0 at the end of the
+   file. */
+int
+pcapfile_next(struct pcapfile * pf, struct pcapfile_pkt * pkt)
+{
+	size_t drop;
+	int ret;
+
+	if (!pf || !pkt) return -1;
+
+	if (!pf->z && pf->off - pf->dropped >= 2 * DROP_CHUNK) {
+		drop = DROP_CHUNK;
+		/* pages still mapped are not evicted, so the mapping is
+		   let go of first */
+		madvise((void *)(pf->map + pf->dropped), drop, MADV_DONTNEED);
+		posix_fadvise(pf->fd, pf->dropped, drop, POSIX_FADV_DONTNEED);
+		pf->dropped += drop;
+	}
+
+	if (!pf->ng) {
+		ret = pcap_record(pf, pkt);
+		return (ret < 0 ? 0 : ret);
+	}
+
+	while ((ret = pcapng_block(pf, pkt)) == 0);
+	return (ret < 0 ? 0 : ret);
+}
+
+void
+pcapfile_close(struct pcapfile * pf)
+{
+	if (!pf) return;
+
+	if (pf->z) zstream_close(pf->z);
+	else if (pf->map) munmap((void *)pf->map, pf->size);
+	close(pf->fd);
+	free(pf->ifaces);
+	free(pf);
+}
+
+/* EOF */
@@ -0,0 +1,30 @@
+/* pcapfile.h */
+
+#ifndef PCAPFILE_H
+  #define PCAPFILE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct pcapfile;
+
+/* A packet as found in the capture file, data points into the mapping
+   of the file or a block of a compressed one and stays valid until the
+   next call to pcapfile_next(). */
+struct pcapfile_pkt {
+	uint64_t ts_nsec;
+	uint32_t caplen;
+	uint32_t len;
+	int linktype;
+	const unsigned char * data;
+};
+
+struct pcapfile * pcapfile_open(const char *);
+int pcapfile_linktype(struct pcapfile *);
+int pcapfile_snaplen(struct pcapfile *);
+int pcapfile_next(struct pcapfile *, struct pcapfile_pkt *);
+void pcapfile_close(struct pcapfile *);
+
+#endif
+
+/* EOF */
@@ -0,0 +1,44 @@
+/* probes.h */
+
+#ifndef PROBES_H
+  #define PROBES_H
+
+/* USDT probes for tracing with perf, bpftrace or systemtap. Build with
+   SDT=1 to get them, otherwise the PROBEn macros expand to nothing and
+   there is no probe site at all. Built in, a probe site is only a nop
+   instruction and a note in the binary while no tracer is attached,
+   the arguments are plain integers.
+
+   provider trafficker (libtrafficker):
+     flow_established(hash, saddr, daddr, sport, dport)
+     flow_closed(hash, nids_state, open_sessions)
+     flow_skipped(hash, bytes)
+     burst_emitted(hash, client, len, incomplete)
+     record_parsed(record_type, length)
+
+   provider gmaps (gmaps-trafficker):
+     pair_matched(hash, reqlen, reslen, ts)
+     window_start(first_ts, last_ts, zoom_mask)
+     window_end(first_ts, pairs, candidates, retangles, ns)
+*/
+
+#ifdef HAVE_SDT
+  #include <sys/sdt.h>
+  #define PROBE0(p, n)			DTRACE_PROBE(p, n)
+  #define PROBE1(p, n, a)		DTRACE_PROBE1(p, n, a)
+  #define PROBE2(p, n, a, b)		DTRACE_PROBE2(p, n, a, b)
+  #define PROBE3(p, n, a, b, c)		DTRACE_PROBE3(p, n, a, b, c)
+  #define PROBE4(p, n, a, b, c, d)	DTRACE_PROBE4(p, n, a, b, c, d)
+  #define PROBE5(p, n, a, b, c, d, e)	DTRACE_PROBE5(p, n, a, b, c, d, e)
+#else
+  #define PROBE0(p, n)			do { } while (0)
+  #define PROBE1(p, n, a)		do { } while (0)
+  #define PROBE2(p, n, a, b)		do { } while (0)
+  #define PROBE3(p, n, a, b, c)		do { } while (0)
+  #define PROBE4(p, n, a, b, c, d)	do { } while (0)
+  #define PROBE5(p, n, a, b, c, d, e)	do { } while (0)
+#endif
+
+#endif
+
+/* EOF */
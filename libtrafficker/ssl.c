@@ -1,9 +1,11 @@
 /* ssl.c */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "ssl.h"
+#include "probes.h"
 
 /* Returns -1 if the parsing failed, 0 if the parsing succeeded
    and only in the case of success will the ssl_parse structure
@@ -54,8 +56,154 @@ ssl_parse(char * ibuf, size_t len, struct ssl_parse * ret)
 	ret->record_type = record_type;
 	ret->data = data;
 	ret->data_len = data_len;
+	PROBE2(trafficker, record_parsed, record_type, msg_len);
 
 	return 0;
 }
 
+/* Checks if the data a connection starts with in one direction looks
+   like SSL/TLS. Returns 1 if it does, 0 if more data is needed to tell
+   and -1 if it doesn't. */
+int
+ssl_check(const char * ibuf, size_t len)
+{
+	const unsigned char * buf;
+	size_t msg_len;
+
+	buf = (const unsigned char *)(ibuf);
+	if (!len) return 0;
+
+	/* SSLv2 compatible client hello */
+	if (buf[0] & 0x80) {
+		if (len < 4) return 0;
+		return (buf[2] == 1 && buf[3] == 3 ? 1 : -1);
+	}
+
+	if (buf[0] < SSL_MSG_CHANGE_CIPHER_SPEC ||
+			buf[0] > SSL_MSG_APPLICATION_DATA)
+		return -1;
+	if (len < 3) return 0;
+	if (buf[1] != 3 || buf[2] > 4) return -1;
+	if (len < 5) return 0;
+
+	msg_len = (buf[3] << 8) | buf[4];
+	if (!msg_len || msg_len > SSL_MAX_RECORD_LEN) return -1;
+
+	return 1;
+}
+
+void
+ssl_scan_init(struct ssl_scan * s)
+{
+	memset(s, 0, sizeof(struct ssl_scan));
+}
+
+/* Returns 1 if the scan is between two records, it never is again once
+   the data stopped looking like SSL. */
+int
+ssl_scan_boundary(const struct ssl_scan * s)
+{
+	return (!s->nr_hdr && !s->left && !s->error);
+}
+
+/* Decodes the header gathered in the scan state. Returns -1 if it's not
+   the header of a record. An SSLv2 header is only two bytes, the two
+   bytes after it are gathered too as they tell if it's a client hello
+   and they count as payload. */
+static int
+scan_header(struct ssl_scan * s)
+{
+	const unsigned char * hdr = s->hdr;
+
+	if (hdr[0] & 0x80) {
+		if (hdr[2] != 1 || hdr[3] != 3) return -1;
+		s->type = SSL_MSG_HANDSHAKE;
+		s->len = ((hdr[0] & 0x7f) << 8) | hdr[1];
+		if (s->len < 2) return -1;
+		s->left = s->len - 2;
+		return 0;
+	}
+
+	if (hdr[0] < SSL_MSG_CHANGE_CIPHER_SPEC ||
+			hdr[0] > SSL_MSG_APPLICATION_DATA || hdr[1] != 3)
+		return -1;
+	s->type = hdr[0];
+	s->len = (hdr[3] << 8) | hdr[4];
+	s->left = s->len;
+	return 0;
+}
+
+static void
+scan_record(struct ssl_record * r, int type, uint32_t len, int64_t offset)
+{
+	r->type = type;
+	r->len = len;
+	r->offset = offset;
+	PROBE2(trafficker, record_parsed, type, len);
+}
+
+/* Scans the next len bytes of a stream for records. The records ending
+   in the range are put in records, up to max of them, and their number
+   is returned. The number of bytes scanned is put in used, it's less
+   than len when max records were found or when the data stopped looking
+   like SSL, then error is set in the state and the scan stays stopped.
+
+   Between records the headers of whole application data records in the
+   range are hopped over without going through the state, that's the
+   bulk of the bytes of a connection fetching tiles. Every hop depends on
+   the length in the header before it, so there's nothing to gain from
+   looking at several bytes at once. */
+size_t
+ssl_scan(struct ssl_scan * s, const char * ibuf, size_t len,
+	struct ssl_record * records, size_t max, size_t * used)
+{
+	const unsigned char * buf;
+	size_t i = 0, n = 0, k;
+	uint32_t msg_len;
+
+	buf = (const unsigned char *)(ibuf);
+	while (i < len && n < max && !s->error) {
+		if (s->left) {
+			k = (s->left < len - i ? s->left : len - i);
+			s->left -= k;
+			i += k;
+			if (!s->left) {
+				scan_record(&(records[n++]), s->type, s->len,
+					(int64_t)(s->start - s->pos));
+			}
+			continue;
+		}
+
+		if (!s->nr_hdr) {
+			while (n < max && len - i >= 5 &&
+					buf[i] == SSL_MSG_APPLICATION_DATA &&
+					buf[i + 1] == 3) {
+				msg_len = (buf[i + 3] << 8) | buf[i + 4];
+				if (len - i - 5 < msg_len) break;
+				scan_record(&(records[n++]),
+					SSL_MSG_APPLICATION_DATA, msg_len, i);
+				i += msg_len + 5;
+			}
+			if (i == len || n == max) break;
+			s->start = s->pos + i;
+		}
+
+		s->hdr[s->nr_hdr++] = buf[i++];
+		if (s->nr_hdr < (s->hdr[0] & 0x80 ? 4 : 5)) continue;
+		s->nr_hdr = 0;
+		if (scan_header(s) < 0) {
+			s->error = 1;
+			break;
+		}
+		if (!s->left) {
+			scan_record(&(records[n++]), s->type, s->len,
+				(int64_t)(s->start - s->pos));
+		}
+	}
+
+	s->pos += i;
+	*used = i;
+	return n;
+}
+
 /* EOF */
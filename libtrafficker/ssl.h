@@ -1,10 +1,20 @@
 /* ssl.h */
 
+#ifndef SSL_H
+  #define SSL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
 #define SSL_MSG_CHANGE_CIPHER_SPEC     20
 #define SSL_MSG_ALERT                  21
 #define SSL_MSG_HANDSHAKE              22
 #define SSL_MSG_APPLICATION_DATA       23
 
+/* biggest record payload allowed, 2^14 plus the expansion of a
+   compressed and encrypted record */
+#define SSL_MAX_RECORD_LEN             (16384 + 2048)
+
 struct ssl_parse {
 	size_t total_read;
 	int record_type;	
@@ -12,6 +22,37 @@ struct ssl_parse {
 	size_t data_len;
 };
 
+/* a record found by ssl_scan(), the offset is where its header starts
+   relative to the range passed in, it's negative for a record that
+   started in an earlier range */
+struct ssl_record {
+	int type;
+	uint32_t len;
+	int64_t offset;
+};
+
+/* State of the scan of one direction of a stream, carried from one
+   range to the next. A record can end anywhere, even in its header. */
+struct ssl_scan {
+	unsigned char hdr[5];
+	uint32_t nr_hdr;
+	int type;
+	uint32_t len;
+	/* payload bytes of the current record still to come */
+	uint32_t left;
+	/* stream offsets of the current record and of the next range */
+	uint64_t start;
+	uint64_t pos;
+	int error;
+};
+
 int ssl_parse(char *, size_t, struct ssl_parse *);
+int ssl_check(const char *, size_t);
+void ssl_scan_init(struct ssl_scan *);
+size_t ssl_scan(struct ssl_scan *, const char *, size_t, struct ssl_record *,
+	size_t, size_t *);
+int ssl_scan_boundary(const struct ssl_scan *);
+
+#endif
 
 /* EOF */
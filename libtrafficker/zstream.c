@@ -0,0 +1,340 @@
+/* zstream.c */
+
+/* Decompression of compressed capture files in a reader thread. The
+   thread fills blocks with decompressed data and hands them over
+   through a bounded queue, so decompression overlaps with the
+   processing of the packets. Every block ends at a record boundary as
+   told by the split callback, which lets the records of a block be
+   parsed in place just like those of a mapped file. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+  #include <zstd.h>
+#endif
+
+#include "zstream.h"
+
+/* number of blocks going round between the threads and their initial
+   size, a block grows when a single record doesn't fit */
+#define ZBLOCKS			4
+#define ZBLOCK_SIZE		(1024 * 1024)
+
+#define ZSTD_IN_SIZE		(128 * 1024)
+
+struct zblock {
+	unsigned char * data;
+	size_t len;
+	size_t alloc;
+};
+
+struct zstream {
+	int fd;
+	int type;
+	gzFile gz;
+#ifdef HAVE_ZSTD
+	ZSTD_DStream * zs;
+	ZSTD_inBuffer zin;
+	unsigned char * zinbuf;
+	int zeof;
+#endif
+	zstream_split split;
+	void * arg;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct zblock blocks[ZBLOCKS];
+	int full[ZBLOCKS];
+	uint32_t full_head;
+	uint32_t full_count;
+	int free[ZBLOCKS];
+	uint32_t free_count;
+	int current;
+	int done;
+	int error;
+	int stop;
+
+	/* the start of a record cut off at the end of the last block */
+	unsigned char * carry;
+	size_t carrylen;
+	size_t carryalloc;
+};
+
+/* Returns the compression type of a file starting with data. */
+int
+zstream_detect(const unsigned char * data, size_t len)
+{
+	if (len >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+		return ZSTREAM_GZIP;
+	if (len >= 4 && data[0] == 0x28 && data[1] == 0xb5 &&
+			data[2] == 0x2f && data[3] == 0xfd)
+		return ZSTREAM_ZSTD;
+	return ZSTREAM_NONE;
+}
+
+/* Decompresses up to len bytes, returns 0 at the end of the input. */
+static ssize_t
+zstream_read(struct zstream * z, unsigned char * buf, size_t len)
+{
+#ifdef HAVE_ZSTD
+	ZSTD_outBuffer zout;
+	ssize_t ret;
+	size_t zret;
+#endif
+
+	if (z->type == ZSTREAM_GZIP) {
+		if (len > (1U << 30)) len = (1U << 30);
+		return gzread(z->gz, buf, len);
+	}
+
+#ifdef HAVE_ZSTD
+	zout.dst = buf;
+	zout.size = len;
+	zout.pos = 0;
+	while (!zout.pos) {
+		if (z->zin.pos == z->zin.size) {
+			if (z->zeof) return 0;
+			ret = read(z->fd, z->zinbuf, ZSTD_IN_SIZE);
+			if (ret < 0) return -1;
+			if (!ret) z->zeof = 1;
+			z->zin.src = z->zinbuf;
+			z->zin.size = ret;
+			z->zin.pos = 0;
+		}
+		zret = ZSTD_decompressStream(z->zs, &zout, &(z->zin));
+		if (ZSTD_isError(zret)) return -1;
+		if (z->zeof && !zout.pos && z->zin.pos == z->zin.size)
+			return 0;
+	}
+	return zout.pos;
+#else
+	return -1;
+#endif
+}
+
+static int
+zblock_grow(struct zblock * b, size_t alloc)
+{
+	unsigned char * data;
+
+	if (b->alloc >= alloc) return 0;
+	data = realloc(b->data, alloc);
+	if (!data) return -1;
+	b->data = data;
+	b->alloc = alloc;
+	return 0;
+}
+
+/* Fills block b with whole records, returns 1 at the end of the input
+   and -1 on errors. */
+static int
+zstream_fill(struct zstream * z, struct zblock * b)
+{
+	unsigned char * carry;
+	ssize_t ret;
+	size_t n;
+
+	if (zblock_grow(b, z->carrylen * 2) < 0) return -1;
+	if (z->carrylen) memcpy(b->data, z->carry, z->carrylen);
+	b->len = z->carrylen;
+	z->carrylen = 0;
+
+	while (1) {
+		if (b->len == b->alloc) {
+			n = z->split(z->arg, b->data, b->len);
+			if (n) break;
+
+			/* a single record bigger than the block */
+			if (zblock_grow(b, b->alloc * 2) < 0) return -1;
+		}
+
+		ret = zstream_read(z, b->data + b->len, b->alloc - b->len);
+		if (ret < 0) return -1;
+		if (!ret) return 1;
+		b->len += ret;
+	}
+
+	/* keep the cut off record for the next block */
+	if (n < b->len) {
+		if (z->carryalloc < b->len - n) {
+			carry = realloc(z->carry, b->len - n);
+			if (!carry) return -1;
+			z->carry = carry;
+			z->carryalloc = b->len - n;
+		}
+		z->carrylen = b->len - n;
+		memcpy(z->carry, b->data + n, z->carrylen);
+		b->len = n;
+	}
+
+	return 0;
+}
+
+static void *
+zstream_reader(void * arg)
+{
+	struct zstream * z = arg;
+	int idx, ret = 0;
+
+	while (!ret) {
+		pthread_mutex_lock(&(z->lock));
+		while (!z->free_count && !z->stop)
+			pthread_cond_wait(&(z->cond), &(z->lock));
+		if (z->stop) {
+			pthread_mutex_unlock(&(z->lock));
+			return NULL;
+		}
+		idx = z->free[--z->free_count];
+		pthread_mutex_unlock(&(z->lock));
+
+		ret = zstream_fill(z, &(z->blocks[idx]));
+
+		pthread_mutex_lock(&(z->lock));
+		if (ret >= 0 && z->blocks[idx].len) {
+			z->full[(z->full_head + z->full_count) % ZBLOCKS] = idx;
+			z->full_count++;
+		}
+		else z->free[z->free_count++] = idx;
+		if (ret) {
+			z->done = 1;
+			z->error = (ret < 0);
+		}
+		pthread_cond_broadcast(&(z->cond));
+		pthread_mutex_unlock(&(z->lock));
+	}
+
+	return NULL;
+}
+
+/* Starts decompressing the file fd points to. The descriptor stays owned
+   by the caller. */
+struct zstream *
+zstream_open(int fd, int type, zstream_split split, void * arg)
+{
+	struct zstream * z;
+	int i, gzfd;
+
+	if (fd < 0 || !split) return NULL;
+#ifndef HAVE_ZSTD
+	if (type == ZSTREAM_ZSTD) return NULL;
+#endif
+	if (type != ZSTREAM_GZIP && type != ZSTREAM_ZSTD) return NULL;
+
+	z = malloc(sizeof(struct zstream));
+	if (!z) return NULL;
+	memset(z, 0, sizeof(struct zstream));
+	z->fd = fd;
+	z->type = type;
+	z->split = split;
+	z->arg = arg;
+	z->current = -1;
+
+	if (type == ZSTREAM_GZIP) {
+		gzfd = dup(fd);
+		if (gzfd < 0) goto fail;
+		z->gz = gzdopen(gzfd, "rb");
+		if (!z->gz) {
+			close(gzfd);
+			goto fail;
+		}
+		gzbuffer(z->gz, 256 * 1024);
+	}
+#ifdef HAVE_ZSTD
+	else {
+		z->zs = ZSTD_createDStream();
+		z->zinbuf = malloc(ZSTD_IN_SIZE);
+		if (!z->zs || !z->zinbuf) goto fail;
+		ZSTD_initDStream(z->zs);
+	}
+#endif
+
+	for (i=0;i<ZBLOCKS;i++) {
+		if (zblock_grow(&(z->blocks[i]), ZBLOCK_SIZE) < 0) goto fail;
+		z->free[z->free_count++] = i;
+	}
+
+	pthread_mutex_init(&(z->lock), NULL);
+	pthread_cond_init(&(z->cond), NULL);
+	if (pthread_create(&(z->thread), NULL, zstream_reader, z)) {
+		pthread_mutex_destroy(&(z->lock));
+		pthread_cond_destroy(&(z->cond));
+		goto fail;
+	}
+
+	return z;
+
+fail:
+	if (z->gz) gzclose(z->gz);
+#ifdef HAVE_ZSTD
+	if (z->zs) ZSTD_freeDStream(z->zs);
+	free(z->zinbuf);
+#endif
+	for (i=0;i<ZBLOCKS;i++) free(z->blocks[i].data);
+	free(z);
+	return NULL;
+}
+
+/* Gets the next block of records, the previous one is given back to
+   the reader thread. Returns 1 if there was one, 0 at the end of the
+   input and -1 on errors. */
+int
+zstream_next(struct zstream * z, const unsigned char ** data, size_t * len)
+{
+	struct zblock * b;
+
+	if (!z || !data || !len) return -1;
+
+	pthread_mutex_lock(&(z->lock));
+	if (z->current >= 0) {
+		z->free[z->free_count++] = z->current;
+		z->current = -1;
+		pthread_cond_broadcast(&(z->cond));
+	}
+	while (!z->full_count && !z->done)
+		pthread_cond_wait(&(z->cond), &(z->lock));
+	if (!z->full_count) {
+		pthread_mutex_unlock(&(z->lock));
+		return (z->error ? -1 : 0);
+	}
+	z->current = z->full[z->full_head];
+	z->full_head = (z->full_head + 1) % ZBLOCKS;
+	z->full_count--;
+	b = &(z->blocks[z->current]);
+	pthread_mutex_unlock(&(z->lock));
+
+	*data = b->data;
+	*len = b->len;
+	return 1;
+}
+
+void
+zstream_close(struct zstream * z)
+{
+	int i;
+
+	if (!z) return;
+
+	pthread_mutex_lock(&(z->lock));
+	z->stop = 1;
+	pthread_cond_broadcast(&(z->cond));
+	pthread_mutex_unlock(&(z->lock));
+	pthread_join(z->thread, NULL);
+	pthread_mutex_destroy(&(z->lock));
+	pthread_cond_destroy(&(z->cond));
+
+	if (z->gz) gzclose(z->gz);
+#ifdef HAVE_ZSTD
+	if (z->zs) ZSTD_freeDStream(z->zs);
+	free(z->zinbuf);
+#endif
+	for (i=0;i<ZBLOCKS;i++) free(z->blocks[i].data);
+	free(z->carry);
+	free(z);
+}
+
+/* EOF */
@@ -0,0 +1,25 @@
+/* zstream.h */
+
+#ifndef ZSTREAM_H
+  #define ZSTREAM_H
+
+#include <stddef.h>
+
+#define ZSTREAM_NONE		0
+#define ZSTREAM_GZIP		1
+#define ZSTREAM_ZSTD		2
+
+/* Returns how many bytes from the start of the data form whole records,
+   it is always called with data starting at a record boundary. */
+typedef size_t (*zstream_split)(void *, const unsigned char *, size_t);
+
+struct zstream;
+
+int zstream_detect(const unsigned char *, size_t);
+struct zstream * zstream_open(int, int, zstream_split, void *);
+int zstream_next(struct zstream *, const unsigned char **, size_t *);
+void zstream_close(struct zstream *);
+
+#endif
+
+/* EOF */
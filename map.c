@@ -92,6 +92,31 @@ map_get(struct map * map, uint32_t key)
 	return NULL;
 }
 
+/* Removes a key from the map and returns its data, NULL if the key
+   isn't in it. */
+void *
+map_del(struct map * map, uint32_t key)
+{
+	struct map_entry * entry, ** prev;
+	void * data;
+
+	if (!map) return NULL;
+
+	prev = &(map->entries[key % map->hash_size]);
+	while ((entry = *prev) != NULL) {
+		if (entry->key == key) {
+			*prev = entry->next;
+			data = entry->data;
+			free(entry);
+			map->count--;
+			return data;
+		}
+		prev = &(entry->next);
+	}
+
+	return NULL;
+}
+
 void
 map_free(struct map * map, void (*data_free)(void *))
 {
@@ -109,6 +134,7 @@ map_free(struct map * map, void (*data_free)(void *))
 		}
 	}
 
+	free(map->entries);
 	free(map);
 }
 
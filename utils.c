@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include <pwd.h>
 
@@ -106,6 +107,19 @@ write_uint8(FILE * f, uint8_t t)
 	}
 }
 
+void
+write_data(FILE * f, const void * data, size_t len)
+{
+	size_t ret;
+
+	if (!len) return;
+	ret = fwrite(data, len, 1, f);
+	if (ret != 1) {
+		fprintf(stderr, "Error while writing to file.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
 inline static void
 passwd_clear(struct passwd * pwd)
 {
@@ -161,4 +175,15 @@ err:
 	fatal("privdrop failed");
 }
 
+/* Returns CLOCK_MONOTONIC in nanoseconds, it is the same clock in all
+   processes so the values can be passed between them. */
+uint64_t
+monotonic_ns()
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (uint64_t)tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
 /* EOF */
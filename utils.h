@@ -13,8 +13,10 @@ uint8_t read_uint8(FILE *);
 void write_uint32(FILE *, uint32_t);
 void write_uint16(FILE *, uint16_t);
 void write_uint8(FILE *, uint8_t);
+void write_data(FILE *, const void *, size_t);
 void fatal(const char *);
 void privdrop(const char *);
+uint64_t monotonic_ns();
 
 #endif
 